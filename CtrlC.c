@@ -1,35 +1,32 @@
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <fcntl.h>
-#include <unistd.h>
+#include <string.h>
 #include <linux/input.h>
 
-#define EVENT_DEV "/dev/input/event5" // Thay thế bằng số thiết bị sự kiện của bạn
-#define KEY_K 37 // Key code for 'K'
-
-int main() {
-    int fd = open(EVENT_DEV, O_RDONLY);
-    if (fd == -1) {
-        perror("Cannot open device");
-        exit(EXIT_FAILURE);
-    }
+#include "kbd_evdev.h"
 
-    struct input_event ev;
+// Thoát khi nhấn K; không có tham số thì tự tìm bàn phím usbkbd qua sysfs
+static int on_frame(int fd, const struct input_event *ev, unsigned int n, void *arg) {
+    for (unsigned int i = 0; i < n; i++)
+        if (ev[i].type == EV_KEY && ev[i].code == KEY_K && ev[i].value == 1)
+            return 1;
+    return 0;
+}
 
-    while (1) {
-        if (read(fd, &ev, sizeof(struct input_event)) == -1) {
-            perror("Failed to read device");
-            exit(EXIT_FAILURE);
-        }
+int main(int argc, char **argv) {
+    struct kbd_evdev *kd = kbd_evdev_open(argc > 1 ? argv[1] : NULL, O_RDONLY);
+    if (!kd)
+        exit(EXIT_FAILURE);
 
-        if (ev.type == EV_KEY && ev.code == KEY_K && ev.value == 1) {
-            // K key pressed, exit the program
-            printf("Exiting program...\n");
-            break;
-        }
+    int ret = kbd_evdev_run(kd, on_frame, NULL);
+    kbd_evdev_close(kd);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to read device: %s\n", strerror(-ret));
+        exit(EXIT_FAILURE);
     }
 
-    close(fd);
+    // K key pressed, exit the program
+    printf("Exiting program...\n");
     return 0;
 }
-
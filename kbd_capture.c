@@ -0,0 +1,183 @@
+/*
+ * Dump the usbkbd raw report capture ring to a file kbd_replay can read.
+ *
+ *   sudo ./kbd_capture -o reports.bin 1-1:1.0     until Ctrl-C
+ *   sudo ./kbd_capture -n 1000 -t 1-1:1.0         1000 records as text
+ *   ./kbd_replay -f reports.bin                    replay what was captured
+ *
+ * The interface name is the one under /sys/bus/usb/drivers/usbkbd/.
+ * Capture is switched on for the duration of the run.  Records are read
+ * straight from the mapped ring; the only syscalls are the writes of the
+ * output file and a short sleep when the ring is empty.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "usbkbd_capture.h"
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    stop = 1;
+}
+
+static int set_capture(const char *intf, int on)
+{
+    char path[256];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/capture", intf);
+    f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "%d\n", on);
+    if (fclose(f)) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-o reports.bin] [-n count] [-t] <interface>\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    const char *out_path = NULL, *intf;
+    struct usb_kbd_capture_header *hdr;
+    unsigned long long limit = 0, seen = 0, errors = 0;
+    unsigned char report[256];
+    struct timespec idle = {0, 10000000};
+    struct sigaction sa;
+    char path[256];
+    bool text = false;
+    size_t size;
+    FILE *out;
+    int fd, opt;
+    u64 tail, head;
+    void *map;
+
+    while ((opt = getopt(argc, argv, "o:n:t")) != -1) {
+        switch (opt) {
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'n':
+            limit = strtoull(optarg, NULL, 0);
+            break;
+        case 't':
+            text = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usage(argv[0]);
+    intf = argv[optind];
+
+    out = out_path ? fopen(out_path, text ? "w" : "wb") : stdout;
+    if (!out) {
+        perror(out_path);
+        return EXIT_FAILURE;
+    }
+    if (!out_path && !text && isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "refusing to write binary reports to a terminal, use -o or -t\n");
+        return EXIT_FAILURE;
+    }
+
+    if (set_capture(intf, 1))
+        return EXIT_FAILURE;
+
+    snprintf(path, sizeof(path), "/sys/kernel/debug/usbkbd/%s/capture", intf);
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    /* Map the header alone to learn the ring size, then the whole ring */
+    hdr = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    if (hdr->magic != USB_KBD_CAPTURE_MAGIC || hdr->version != USB_KBD_CAPTURE_VERSION ||
+        hdr->record_size != sizeof(struct usb_kbd_capture_record) ||
+        hdr->nr_records & (hdr->nr_records - 1) || hdr->report_len > sizeof(report)) {
+        fprintf(stderr, "%s: unknown capture ring format\n", path);
+        return EXIT_FAILURE;
+    }
+    size = hdr->records_offset + (size_t)hdr->nr_records * hdr->record_size;
+    munmap(hdr, sysconf(_SC_PAGESIZE));
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    hdr = map;
+    fprintf(stderr, "%s: %u records, %s, %u-byte reports\n", intf, hdr->nr_records,
+            hdr->report_mode ? "report protocol" : "boot protocol", hdr->report_len);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* Start with whatever is in the ring already */
+    tail = hdr->tail;
+    while (!stop && (!limit || seen < limit)) {
+        head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        for (; tail != head && (!limit || seen < limit); tail++, seen++) {
+            const struct usb_kbd_capture_record *rec =
+                map + hdr->records_offset + (tail & (hdr->nr_records - 1)) * hdr->record_size;
+            unsigned int n = rec->len < USB_KBD_CAPTURE_DATA ? rec->len : USB_KBD_CAPTURE_DATA;
+            unsigned int i;
+
+            if (text) {
+                fprintf(out, "%llu.%09llu %d %u ", (unsigned long long)rec->ns / 1000000000ULL,
+                        (unsigned long long)rec->ns % 1000000000ULL, rec->status, rec->len);
+                for (i = 0; i < n; i++)
+                    fprintf(out, "%02x", rec->data[i]);
+                fputc('\n', out);
+                continue;
+            }
+
+            /* kbd_replay wants fixed-size reports; error completions carry none */
+            if (rec->status) {
+                errors++;
+                continue;
+            }
+            memset(report, 0, sizeof(report));
+            memcpy(report, rec->data, n);
+            fwrite(report, hdr->report_len, 1, out);
+        }
+        __atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    set_capture(intf, 0);
+    fprintf(stderr, "%llu records, %llu error completions skipped, %llu dropped by the driver\n",
+            seen, errors, (unsigned long long)hdr->dropped);
+    if (out != stdout)
+        fclose(out);
+    return EXIT_SUCCESS;
+}
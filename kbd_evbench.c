@@ -0,0 +1,143 @@
+/*
+ * Compare the one-read()-per-event loop of the old tools (CtrlC.c and
+ * friends) with the batched kbd_evdev reader on the same keyboard.
+ *
+ *   sudo ./kbd_evbench                       first usbkbd keyboard, 10000 events
+ *   sudo ./kbd_evbench -n 100000 /dev/input/event5
+ *
+ * Both readers run at once, each in its own process, while something
+ * types (test_evdev.sh plays kbd_gadget's script).  Each stops after
+ * the given number of events and prints its syscalls and CPU time per
+ * 10k events.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "kbd_evdev.h"
+
+static unsigned long long target = 10000;
+
+static void report(const char *name, unsigned long long events, unsigned long long syscalls)
+{
+    struct rusage ru;
+    double cpu_ms, per10k;
+
+    getrusage(RUSAGE_SELF, &ru);
+    cpu_ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0 +
+             (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+    per10k = events ? 10000.0 / events : 0.0;
+    printf("%-8s %9llu events %9llu syscalls %9.1f syscalls/10k %8.2f ms CPU/10k %6.2f events/syscall\n", name,
+           events, syscalls, syscalls * per10k, cpu_ms * per10k, syscalls ? (double)events / syscalls : 0.0);
+    fflush(stdout);
+}
+
+/* What CtrlC.c used to do */
+static void per_event_reader(const char *path)
+{
+    unsigned long long events = 0, syscalls = 0;
+    struct input_event ev;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        perror(path);
+        _exit(EXIT_FAILURE);
+    }
+    while (events < target) {
+        syscalls++;
+        if (read(fd, &ev, sizeof(ev)) != sizeof(ev)) {
+            perror(path);
+            _exit(EXIT_FAILURE);
+        }
+        events++;
+    }
+    report("per-event", events, syscalls);
+    _exit(EXIT_SUCCESS);
+}
+
+static int count_frame(int fd, const struct input_event *ev, unsigned int n, void *arg)
+{
+    const struct kbd_evdev_stats *st = arg;
+
+    return st->events >= target;
+}
+
+static void batched_reader(const char *path)
+{
+    const struct kbd_evdev_stats *st;
+    struct kbd_evdev *kd;
+    int ret;
+
+    kd = kbd_evdev_open(path, O_RDONLY);
+    if (!kd)
+        _exit(EXIT_FAILURE);
+    st = kbd_evdev_stats(kd);
+    ret = kbd_evdev_run(kd, count_frame, (void *)st);
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(-ret));
+        _exit(EXIT_FAILURE);
+    }
+    report("batched", st->events, st->waits + st->reads);
+    _exit(EXIT_SUCCESS);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n events] [evdev]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    char paths[1][KBD_EVDEV_PATH];
+    const char *path;
+    int opt, status, failed = 0;
+    pid_t pid[2];
+    unsigned int i;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            target = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind > 1 || !target)
+        usage(argv[0]);
+
+    if (optind < argc) {
+        path = argv[optind];
+    } else {
+        if (!kbd_evdev_find(paths, 1)) {
+            fprintf(stderr, "no \"%s\" input device found\n", KBD_EVDEV_NAME);
+            return EXIT_FAILURE;
+        }
+        path = paths[0];
+    }
+    printf("%s, %llu events per reader\n", path, target);
+    fflush(stdout);
+
+    for (i = 0; i < 2; i++) {
+        pid[i] = fork();
+        if (pid[i] < 0) {
+            perror("fork");
+            return EXIT_FAILURE;
+        }
+        if (!pid[i]) {
+            if (i)
+                batched_reader(path);
+            per_event_reader(path);
+        }
+    }
+    for (i = 0; i < 2; i++)
+        if (waitpid(pid[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+            failed = 1;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,287 @@
+/*
+ * Batched evdev reader shared by the userspace tools, see kbd_evdev.h.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+
+#include "kbd_evdev.h"
+
+struct kbd_evdev_dev {
+    int fd;
+    unsigned int pending;  /* events of an unfinished frame at the start of buf */
+    int dropping;          /* discard up to the next SYN_REPORT */
+    char path[KBD_EVDEV_PATH];
+    struct input_event buf[KBD_EVDEV_BATCH];
+};
+
+struct kbd_evdev {
+    int epfd;
+    unsigned int ndev, live;
+    volatile sig_atomic_t stop;
+    struct kbd_evdev_stats stats;
+    struct kbd_evdev_dev dev[];
+};
+
+static int read_attr(const char *dir, const char *name, char *buf, size_t len)
+{
+    char path[256];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+    if (!fgets(buf, len, f))
+        buf[0] = 0;
+    fclose(f);
+    buf[strcspn(buf, "\n")] = 0;
+    return 0;
+}
+
+static int is_usbkbd(const char *event)
+{
+    size_t len, suffix = strlen(KBD_EVDEV_PHYS_SUFFIX);
+    char dir[128], name[128], phys[128];
+
+    snprintf(dir, sizeof(dir), "/sys/class/input/%s/device", event);
+    if (read_attr(dir, "name", name, sizeof(name)) || strcmp(name, KBD_EVDEV_NAME))
+        return 0;
+    if (read_attr(dir, "phys", phys, sizeof(phys)))
+        return 0;
+    len = strlen(phys);
+    return len > suffix && !strcmp(phys + len - suffix, KBD_EVDEV_PHYS_SUFFIX);
+}
+
+int kbd_evdev_find(char paths[][KBD_EVDEV_PATH], unsigned int max)
+{
+    struct dirent *de;
+    unsigned int n = 0;
+    DIR *dir;
+
+    dir = opendir("/sys/class/input");
+    if (!dir)
+        return 0;
+    while (n < max && (de = readdir(dir))) {
+        if (strncmp(de->d_name, "event", 5) || !is_usbkbd(de->d_name))
+            continue;
+        snprintf(paths[n++], KBD_EVDEV_PATH, "/dev/input/%.*s", KBD_EVDEV_PATH - 12, de->d_name);
+    }
+    closedir(dir);
+    return n;
+}
+
+struct kbd_evdev *kbd_evdev_open(const char *path, int flags)
+{
+    char paths[KBD_EVDEV_MAX][KBD_EVDEV_PATH];
+    struct kbd_evdev *kd;
+    unsigned int i, n;
+
+    if (path) {
+        snprintf(paths[0], KBD_EVDEV_PATH, "%s", path);
+        n = 1;
+    } else {
+        n = kbd_evdev_find(paths, KBD_EVDEV_MAX);
+        if (!n) {
+            fprintf(stderr, "no \"%s\" input device found\n", KBD_EVDEV_NAME);
+            return NULL;
+        }
+    }
+
+    kd = calloc(1, sizeof(*kd) + n * sizeof(kd->dev[0]));
+    if (!kd) {
+        perror("calloc");
+        return NULL;
+    }
+    kd->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (kd->epfd < 0) {
+        perror("epoll_create1");
+        free(kd);
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct kbd_evdev_dev *d = &kd->dev[i];
+        struct epoll_event ee = {.events = EPOLLIN, .data.ptr = d};
+        int clock = CLOCK_MONOTONIC;
+
+        memcpy(d->path, paths[i], KBD_EVDEV_PATH);
+        d->fd = open(d->path, flags | O_NONBLOCK | O_CLOEXEC);
+        kd->ndev++;
+        if (d->fd < 0) {
+            perror(d->path);
+            kbd_evdev_close(kd);
+            return NULL;
+        }
+        /* Not an evdev node (a FIFO in a test, say) if this fails; nothing to do then */
+        ioctl(d->fd, EVIOCSCLOCKID, &clock);
+        if (epoll_ctl(kd->epfd, EPOLL_CTL_ADD, d->fd, &ee)) {
+            perror("epoll_ctl");
+            kbd_evdev_close(kd);
+            return NULL;
+        }
+    }
+    kd->live = n;
+    return kd;
+}
+
+static void remove_dev(struct kbd_evdev *kd, struct kbd_evdev_dev *d)
+{
+    epoll_ctl(kd->epfd, EPOLL_CTL_DEL, d->fd, NULL);
+    close(d->fd);
+    d->fd = -1;
+    kd->live--;
+}
+
+/*
+ * Split buf[0..end) into frames, keeping an unfinished one for the next
+ * read.  Only a callback that stopped early leaves whole frames behind.
+ */
+static int deliver(struct kbd_evdev *kd, struct kbd_evdev_dev *d, unsigned int end, kbd_evdev_fn fn, void *arg)
+{
+    unsigned int i, start = 0;
+    int ret = 0;
+
+    for (i = 0; i < end && !ret; i++) {
+        const struct input_event *ev = &d->buf[i];
+
+        if (ev->type != EV_SYN)
+            continue;
+        if (ev->code == SYN_DROPPED) {
+            kd->stats.dropped++;
+            d->dropping = 1;
+            start = i + 1;
+        } else if (ev->code == SYN_REPORT) {
+            if (!d->dropping) {
+                kd->stats.frames++;
+                ret = fn(d->fd, &d->buf[start], i + 1 - start, arg);
+            }
+            d->dropping = 0;
+            start = i + 1;
+        }
+    }
+
+    d->pending = end - start;
+    memmove(d->buf, &d->buf[start], d->pending * sizeof(d->buf[0]));
+    if (d->pending == KBD_EVDEV_BATCH) {
+        /* A frame bigger than the buffer: drop it like the kernel would */
+        kd->stats.dropped++;
+        d->pending = 0;
+        d->dropping = 1;
+    }
+    return ret;
+}
+
+static int drain(struct kbd_evdev *kd, struct kbd_evdev_dev *d, kbd_evdev_fn fn, void *arg)
+{
+    for (;;) {
+        unsigned int space = KBD_EVDEV_BATCH - d->pending, got;
+        ssize_t len;
+        int ret;
+
+        len = read(d->fd, &d->buf[d->pending], space * sizeof(d->buf[0]));
+        kd->stats.reads++;
+        if (len < 0 && (errno == EAGAIN || errno == EINTR))
+            return 0;
+        if (len <= 0) {
+            ret = len ? -errno : -ENODEV;
+            if (ret != -ENODEV)
+                return ret;
+            fprintf(stderr, "%s: keyboard went away\n", d->path);
+            remove_dev(kd, d);
+            return kd->live ? 0 : -ENODEV;
+        }
+
+        got = len / sizeof(d->buf[0]);
+        kd->stats.events += got;
+        ret = deliver(kd, d, d->pending + got, fn, arg);
+        if (ret)
+            return ret;
+        /* A short read means the client buffer is empty; skip the EAGAIN round trip */
+        if (got < space)
+            return 0;
+    }
+}
+
+int kbd_evdev_run(struct kbd_evdev *kd, kbd_evdev_fn fn, void *arg)
+{
+    struct epoll_event ready[KBD_EVDEV_MAX];
+    unsigned int d;
+    int i, n, ret;
+
+    /* Frames left behind by a callback that stopped the last run */
+    for (d = 0; d < kd->ndev; d++) {
+        ret = kd->dev[d].fd >= 0 ? deliver(kd, &kd->dev[d], kd->dev[d].pending, fn, arg) : 0;
+        if (ret)
+            return ret;
+    }
+
+    while (!kd->stop) {
+        n = epoll_wait(kd->epfd, ready, KBD_EVDEV_MAX, -1);
+        kd->stats.waits++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        for (i = 0; i < n; i++) {
+            ret = drain(kd, ready[i].data.ptr, fn, arg);
+            if (ret)
+                return ret;
+        }
+    }
+    return 0;
+}
+
+void kbd_evdev_stop(struct kbd_evdev *kd)
+{
+    kd->stop = 1;
+}
+
+int kbd_evdev_grab(struct kbd_evdev *kd, int on)
+{
+    unsigned int i;
+
+    for (i = 0; i < kd->ndev; i++) {
+        if (kd->dev[i].fd < 0)
+            continue;
+        if (ioctl(kd->dev[i].fd, EVIOCGRAB, (void *)(long)on)) {
+            perror(kd->dev[i].path);
+            /* All or nothing */
+            while (on && i--)
+                if (kd->dev[i].fd >= 0)
+                    ioctl(kd->dev[i].fd, EVIOCGRAB, (void *)0);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int kbd_evdev_fd(const struct kbd_evdev *kd, unsigned int i)
+{
+    return i < kd->ndev ? kd->dev[i].fd : -1;
+}
+
+const struct kbd_evdev_stats *kbd_evdev_stats(const struct kbd_evdev *kd)
+{
+    return &kd->stats;
+}
+
+void kbd_evdev_close(struct kbd_evdev *kd)
+{
+    unsigned int i;
+
+    for (i = 0; i < kd->ndev; i++)
+        if (kd->dev[i].fd >= 0)
+            close(kd->dev[i].fd);
+    close(kd->epfd);
+    free(kd);
+}
@@ -0,0 +1,74 @@
+/*
+ * Batched evdev reader shared by the userspace tools.
+ *
+ * Finds the usbkbd keyboards through sysfs instead of a hardcoded
+ * /dev/input/eventN, waits on all of them with one epoll set and reads
+ * up to KBD_EVDEV_BATCH events per read().  Callbacks get whole frames:
+ * every event up to and including the SYN_REPORT that ends it.  Frames
+ * cut by SYN_DROPPED are discarded rather than delivered half-written.
+ * Event timestamps are CLOCK_MONOTONIC.
+ *
+ *   struct kbd_evdev *kd = kbd_evdev_open(NULL, O_RDONLY);
+ *   kbd_evdev_run(kd, on_frame, arg);
+ *   kbd_evdev_close(kd);
+ */
+#ifndef KBD_EVDEV_H
+#define KBD_EVDEV_H
+
+#include <stddef.h>
+#include <linux/input.h>
+
+/* What usbkbd names its input devices; phys is <usb path>/input0 */
+#define KBD_EVDEV_NAME "USB HIDBP Keyboard"
+#define KBD_EVDEV_PHYS_SUFFIX "/input0"
+
+#define KBD_EVDEV_MAX 64     /* keyboards in one set */
+#define KBD_EVDEV_BATCH 256  /* events per read() */
+#define KBD_EVDEV_PATH 64
+
+struct kbd_evdev;
+
+struct kbd_evdev_stats {
+    unsigned long long waits;   /* epoll_wait() calls */
+    unsigned long long reads;   /* read() calls */
+    unsigned long long events;
+    unsigned long long frames;  /* delivered to the callback */
+    unsigned long long dropped; /* SYN_DROPPED seen or oversized frames */
+};
+
+/*
+ * Called with one frame of @n events read from @fd, the last being the
+ * SYN_REPORT.  Return 0 to keep going; anything else stops
+ * kbd_evdev_run() and is returned by it.
+ */
+typedef int (*kbd_evdev_fn)(int fd, const struct input_event *ev, unsigned int n, void *arg);
+
+/* Fill @paths with the event nodes of up to @max usbkbd keyboards; returns how many */
+int kbd_evdev_find(char paths[][KBD_EVDEV_PATH], unsigned int max);
+
+/*
+ * Open @path, or every usbkbd keyboard if @path is NULL, with @flags
+ * (O_RDONLY or O_RDWR).  Prints the reason and returns NULL on failure.
+ */
+struct kbd_evdev *kbd_evdev_open(const char *path, int flags);
+
+/*
+ * Deliver frames until the callback returns non-zero, kbd_evdev_stop()
+ * is called or the last keyboard goes away (-ENODEV).  Returns the
+ * callback's value, 0 after kbd_evdev_stop() or a negative errno.
+ */
+int kbd_evdev_run(struct kbd_evdev *kd, kbd_evdev_fn fn, void *arg);
+
+/* Async-signal-safe: kbd_evdev_run() returns 0 once the current wait ends */
+void kbd_evdev_stop(struct kbd_evdev *kd);
+
+/* EVIOCGRAB every keyboard in the set, so no other client sees their events */
+int kbd_evdev_grab(struct kbd_evdev *kd, int on);
+
+/* File descriptor of keyboard @i of the set, -1 past the end or once it went away */
+int kbd_evdev_fd(const struct kbd_evdev *kd, unsigned int i);
+
+const struct kbd_evdev_stats *kbd_evdev_stats(const struct kbd_evdev *kd);
+void kbd_evdev_close(struct kbd_evdev *kd);
+
+#endif /* KBD_EVDEV_H */
@@ -0,0 +1,1009 @@
+/*
+ * Virtual USB boot keyboards on dummy_hcd through raw-gadget, so the
+ * driver can be probed and exercised without hardware.
+ *
+ *   sudo modprobe dummy_hcd num=32
+ *   sudo modprobe raw_gadget
+ *   sudo ./kbd_gadget -g 32 -k 2      64 keyboards: 32 gadgets, 2 interfaces each
+ *
+ * Every keyboard interface is a separate usbkbd device.  The program
+ * answers enumeration and HID class requests and keeps the gadgets
+ * connected until it is interrupted.
+ *
+ *   sudo ./kbd_gadget -t                       scripted test on one keyboard
+ *   sudo ./kbd_gadget -t -S high -i 1 -r 8000  8 kHz polling at high speed
+ *   sudo ./kbd_gadget -p -D 2 -r 200 -n 0      after 2 s, keep typing the script
+ *
+ * In test mode the first keyboard plays a scripted report sequence at
+ * the requested rate.  The program checks the evdev stream against the
+ * events written out next to each report, checks the LED reports the driver
+ * sends back under the built-in and a custom led_policy and the keys it
+ * advertises, prints throughput and latency percentiles and exits non-zero
+ * on any mismatch.  Play mode (-p) only types the script, with
+ * no evdev checks and no grab, for other tools to measure against; -n 0
+ * types until interrupted.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include <linux/hid.h>
+#include <linux/input.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "usbkbd_core.h"
+
+#define MAX_GADGETS 64
+#define MAX_KBDS 8 /* keyboard interfaces per gadget */
+#define EP0_MAX 1024
+
+#define VENDOR_ID 0x1d6b  /* Linux Foundation */
+#define PRODUCT_ID 0x0104 /* Multifunction Composite Gadget */
+
+struct raw_ep0 {
+    struct usb_raw_event event;
+    union {
+        struct usb_ctrlrequest ctrl;
+        char data[EP0_MAX];
+    };
+};
+
+struct raw_io {
+    struct usb_raw_ep_io io;
+    char data[EP0_MAX];
+};
+
+struct gadget {
+    int index;
+    int fd;
+    unsigned int nkbds;
+    int ep_addr[MAX_KBDS];   /* interrupt IN endpoint addresses */
+    int ep_handle[MAX_KBDS]; /* raw-gadget handles once configured */
+    volatile bool configured;
+    volatile unsigned char leds[MAX_KBDS];
+    volatile unsigned long led_reports;
+    pthread_t thread;
+};
+
+static const char *udc_driver = "dummy_udc";
+static unsigned int speed = USB_SPEED_HIGH;
+static unsigned int interval; /* bInterval, default 1 ms at either speed */
+static volatile sig_atomic_t stop;
+
+/* Boot keyboard report descriptor (HID 1.11, appendix B.1) */
+static const unsigned char report_desc[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01,
+    0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x08, 0x81, 0x01,
+    0x95, 0x05, 0x75, 0x01, 0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02,
+    0x95, 0x01, 0x75, 0x03, 0x91, 0x01,
+    0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65,
+    0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00,
+    0xc0,
+};
+
+struct hid_class_descriptor {
+    __u8 bLength;
+    __u8 bDescriptorType;
+    __le16 bcdHID;
+    __u8 bCountryCode;
+    __u8 bNumDescriptors;
+    __u8 bReportDescriptorType;
+    __le16 wDescriptorLength;
+} __attribute__((packed));
+
+static void fail(const char *what)
+{
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static int raw_event_fetch(int fd, struct raw_ep0 *ev)
+{
+    ev->event.length = EP0_MAX;
+    return ioctl(fd, USB_RAW_IOCTL_EVENT_FETCH, &ev->event);
+}
+
+static void ep0_write(int fd, const void *data, unsigned int len)
+{
+    struct raw_io io;
+
+    io.io.ep = 0;
+    io.io.flags = 0;
+    io.io.length = len;
+    memcpy(io.data, data, len);
+    if (ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, &io) < 0)
+        perror("ep0 write");
+}
+
+static int ep0_read(int fd, void *data, unsigned int len)
+{
+    struct raw_io io;
+    int ret;
+
+    io.io.ep = 0;
+    io.io.flags = 0;
+    io.io.length = len;
+    ret = ioctl(fd, USB_RAW_IOCTL_EP0_READ, &io);
+    if (ret < 0)
+        perror("ep0 read");
+    else if (data)
+        memcpy(data, io.data, ret);
+    return ret;
+}
+
+static void ep0_stall(int fd)
+{
+    ioctl(fd, USB_RAW_IOCTL_EP0_STALL, 0);
+}
+
+/* Pick an interrupt-capable IN endpoint address per keyboard from the UDC's list */
+static void assign_endpoints(struct gadget *g)
+{
+    struct usb_raw_eps_info info;
+    unsigned int used = 0, k = 0;
+    int i, n;
+
+    memset(&info, 0, sizeof(info));
+    n = ioctl(g->fd, USB_RAW_IOCTL_EPS_INFO, &info);
+    if (n < 0)
+        fail("eps info");
+
+    for (i = 0; i < n && k < g->nkbds; i++) {
+        struct usb_raw_ep_info *ep = &info.eps[i];
+        unsigned int addr = ep->addr;
+
+        if (!ep->caps.type_int || !ep->caps.dir_in)
+            continue;
+        if (addr == USB_RAW_EP_ADDR_ANY) {
+            for (addr = 1; addr < 16 && (used & (1 << addr)); addr++)
+                ;
+            if (addr == 16)
+                continue;
+        } else if (used & (1 << addr)) {
+            continue;
+        }
+        used |= 1 << addr;
+        g->ep_addr[k++] = USB_DIR_IN | addr;
+    }
+    if (k < g->nkbds) {
+        fprintf(stderr, "gadget %d: UDC has only %u interrupt IN endpoints\n", g->index, k);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static unsigned int build_config(const struct gadget *g, unsigned char *buf)
+{
+    struct usb_config_descriptor *cfg = (void *)buf;
+    unsigned int len = USB_DT_CONFIG_SIZE, k;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->bLength = USB_DT_CONFIG_SIZE;
+    cfg->bDescriptorType = USB_DT_CONFIG;
+    cfg->bNumInterfaces = g->nkbds;
+    cfg->bConfigurationValue = 1;
+    cfg->bmAttributes = USB_CONFIG_ATT_ONE | USB_CONFIG_ATT_WAKEUP;
+    cfg->bMaxPower = 50;
+
+    for (k = 0; k < g->nkbds; k++) {
+        struct usb_interface_descriptor intf = {
+            .bLength = USB_DT_INTERFACE_SIZE,
+            .bDescriptorType = USB_DT_INTERFACE,
+            .bInterfaceNumber = k,
+            .bNumEndpoints = 1,
+            .bInterfaceClass = USB_CLASS_HID,
+            .bInterfaceSubClass = 1, /* boot */
+            .bInterfaceProtocol = 1, /* keyboard */
+        };
+        struct hid_class_descriptor hid = {
+            .bLength = sizeof(hid),
+            .bDescriptorType = HID_DT_HID,
+            .bcdHID = __cpu_to_le16(0x0111),
+            .bNumDescriptors = 1,
+            .bReportDescriptorType = HID_DT_REPORT,
+            .wDescriptorLength = __cpu_to_le16(sizeof(report_desc)),
+        };
+        struct usb_endpoint_descriptor ep = {
+            .bLength = USB_DT_ENDPOINT_SIZE,
+            .bDescriptorType = USB_DT_ENDPOINT,
+            .bEndpointAddress = g->ep_addr[k],
+            .bmAttributes = USB_ENDPOINT_XFER_INT,
+            .wMaxPacketSize = __cpu_to_le16(8),
+            .bInterval = interval,
+        };
+
+        memcpy(buf + len, &intf, intf.bLength);
+        len += intf.bLength;
+        memcpy(buf + len, &hid, hid.bLength);
+        len += hid.bLength;
+        memcpy(buf + len, &ep, ep.bLength);
+        len += ep.bLength;
+    }
+    cfg->wTotalLength = __cpu_to_le16(len);
+    return len;
+}
+
+static void send_string(int fd, unsigned int index, unsigned int wlength, const struct gadget *g)
+{
+    unsigned char buf[2 + 2 * 64];
+    char str[64];
+    unsigned int i, len;
+
+    if (index == 0) {
+        buf[0] = 4;
+        buf[1] = USB_DT_STRING;
+        buf[2] = 0x09; /* en-US */
+        buf[3] = 0x04;
+        len = 4;
+    } else {
+        if (index == 1)
+            snprintf(str, sizeof(str), "usbkbd test");
+        else if (index == 2)
+            snprintf(str, sizeof(str), "Virtual Keyboard");
+        else
+            snprintf(str, sizeof(str), "%04d", g->index);
+        len = 2 + 2 * strlen(str);
+        buf[0] = len;
+        buf[1] = USB_DT_STRING;
+        for (i = 0; str[i]; i++) {
+            buf[2 + 2 * i] = str[i];
+            buf[3 + 2 * i] = 0;
+        }
+    }
+    ep0_write(fd, buf, len < wlength ? len : wlength);
+}
+
+static void set_configuration(struct gadget *g)
+{
+    unsigned int k;
+
+    for (k = 0; k < g->nkbds; k++) {
+        struct usb_endpoint_descriptor ep = {
+            .bLength = USB_DT_ENDPOINT_SIZE,
+            .bDescriptorType = USB_DT_ENDPOINT,
+            .bEndpointAddress = g->ep_addr[k],
+            .bmAttributes = USB_ENDPOINT_XFER_INT,
+            .wMaxPacketSize = __cpu_to_le16(8),
+            .bInterval = interval,
+        };
+
+        g->ep_handle[k] = ioctl(g->fd, USB_RAW_IOCTL_EP_ENABLE, &ep);
+        if (g->ep_handle[k] < 0)
+            fail("ep enable");
+    }
+    if (ioctl(g->fd, USB_RAW_IOCTL_VBUS_DRAW, 50) < 0)
+        perror("vbus draw");
+    if (ioctl(g->fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0)
+        perror("configure");
+    g->configured = true;
+}
+
+static void handle_control(struct gadget *g, const struct usb_ctrlrequest *ctrl)
+{
+    unsigned int type = ctrl->bRequestType & USB_TYPE_MASK;
+    unsigned int wvalue = __le16_to_cpu(ctrl->wValue);
+    unsigned int windex = __le16_to_cpu(ctrl->wIndex);
+    unsigned int wlength = __le16_to_cpu(ctrl->wLength);
+    unsigned char buf[EP0_MAX];
+    unsigned int len;
+
+    if (type == USB_TYPE_STANDARD) {
+        switch (ctrl->bRequest) {
+        case USB_REQ_GET_DESCRIPTOR:
+            switch (wvalue >> 8) {
+            case USB_DT_DEVICE: {
+                struct usb_device_descriptor dev = {
+                    .bLength = USB_DT_DEVICE_SIZE,
+                    .bDescriptorType = USB_DT_DEVICE,
+                    .bcdUSB = __cpu_to_le16(0x0200),
+                    .bMaxPacketSize0 = 64,
+                    .idVendor = __cpu_to_le16(VENDOR_ID),
+                    .idProduct = __cpu_to_le16(PRODUCT_ID),
+                    .bcdDevice = __cpu_to_le16(0x0100),
+                    .iManufacturer = 1,
+                    .iProduct = 2,
+                    .iSerialNumber = 3,
+                    .bNumConfigurations = 1,
+                };
+
+                ep0_write(g->fd, &dev, wlength < sizeof(dev) ? wlength : sizeof(dev));
+                return;
+            }
+            case USB_DT_CONFIG:
+                len = build_config(g, buf);
+                ep0_write(g->fd, buf, wlength < len ? wlength : len);
+                return;
+            case USB_DT_STRING:
+                send_string(g->fd, wvalue & 0xff, wlength, g);
+                return;
+            case HID_DT_REPORT:
+                len = sizeof(report_desc);
+                ep0_write(g->fd, report_desc, wlength < len ? wlength : len);
+                return;
+            }
+            break;
+        case USB_REQ_SET_CONFIGURATION:
+            if (!g->configured)
+                set_configuration(g);
+            ep0_read(g->fd, NULL, 0);
+            return;
+        case USB_REQ_SET_INTERFACE:
+            ep0_read(g->fd, NULL, 0);
+            return;
+        }
+    } else if (type == USB_TYPE_CLASS) {
+        switch (ctrl->bRequest) {
+        case HID_REQ_SET_IDLE:
+        case HID_REQ_SET_PROTOCOL:
+            ep0_read(g->fd, NULL, 0);
+            return;
+        case HID_REQ_SET_REPORT:
+            if (ep0_read(g->fd, buf, wlength) >= 1 && windex < g->nkbds) {
+                g->leds[windex] = buf[0];
+                g->led_reports++;
+            }
+            return;
+        }
+    }
+
+    ep0_stall(g->fd);
+}
+
+static void *gadget_thread(void *arg)
+{
+    struct gadget *g = arg;
+    struct raw_ep0 ev;
+
+    while (!stop) {
+        if (raw_event_fetch(g->fd, &ev) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("event fetch");
+            break;
+        }
+        switch (ev.event.type) {
+        case USB_RAW_EVENT_CONNECT:
+            break;
+        case USB_RAW_EVENT_CONTROL:
+            handle_control(g, &ev.ctrl);
+            break;
+        default:
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void gadget_start(struct gadget *g)
+{
+    struct usb_raw_init init;
+
+    g->fd = open("/dev/raw-gadget", O_RDWR);
+    if (g->fd < 0)
+        fail("/dev/raw-gadget");
+
+    memset(&init, 0, sizeof(init));
+    snprintf((char *)init.driver_name, UDC_NAME_LENGTH_MAX, "%s", udc_driver);
+    snprintf((char *)init.device_name, UDC_NAME_LENGTH_MAX, "%s.%d", udc_driver, g->index);
+    init.speed = speed;
+    if (ioctl(g->fd, USB_RAW_IOCTL_INIT, &init) < 0)
+        fail("raw gadget init");
+    if (ioctl(g->fd, USB_RAW_IOCTL_RUN, 0) < 0)
+        fail("raw gadget run");
+
+    assign_endpoints(g);
+    if (pthread_create(&g->thread, NULL, gadget_thread, g))
+        fail("pthread_create");
+}
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int ep_write(struct gadget *g, unsigned int k, const void *data, unsigned int len)
+{
+    struct raw_io io;
+
+    io.io.ep = g->ep_handle[k];
+    io.io.flags = 0;
+    io.io.length = len;
+    memcpy(io.data, data, len);
+    return ioctl(g->fd, USB_RAW_IOCTL_EP_WRITE, &io);
+}
+
+/* The evdev node usbkbd created for gadget @index, -1 if not there (yet) */
+static int find_evdev(unsigned int index)
+{
+    char path[300], phys[128], want[32];
+    struct input_id id;
+    struct dirent *de;
+    DIR *dir;
+    int fd = -1;
+
+    snprintf(want, sizeof(want), ".%u-", index);
+    dir = opendir("/dev/input");
+    if (!dir)
+        return -1;
+    while (fd < 0 && (de = readdir(dir))) {
+        if (strncmp(de->d_name, "event", 5))
+            continue;
+        snprintf(path, sizeof(path), "/dev/input/%s", de->d_name);
+        fd = open(path, O_RDWR);
+        if (fd < 0)
+            continue;
+        memset(phys, 0, sizeof(phys));
+        if (ioctl(fd, EVIOCGID, &id) < 0 || id.vendor != VENDOR_ID || id.product != PRODUCT_ID ||
+            ioctl(fd, EVIOCGPHYS(sizeof(phys) - 1), phys) < 0 || !strstr(phys, want)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    closedir(dir);
+    return fd;
+}
+
+/*
+ * Scripted typing for play mode.  Every report changes the key state, so
+ * each one yields exactly one evdev frame: odd reports release
+ * everything, even ones press one key (two every fifth time), with Shift
+ * every seventh.
+ */
+static unsigned int script_keys[256], nscript_keys;
+
+static void script_init(const u16 *keymap)
+{
+    unsigned int sc;
+
+    for (sc = 0x04; sc <= 0x65; sc++)
+        if (keymap[sc])
+            script_keys[nscript_keys++] = sc;
+}
+
+static void script_report(unsigned int i, unsigned char *rep)
+{
+    unsigned int j = i / 2;
+
+    memset(rep, 0, USB_KBD_BOOT_REPORT_LEN);
+    if (i & 1)
+        return;
+    if (j % 7 == 0)
+        rep[0] = 0x02; /* LeftShift */
+    rep[2] = script_keys[j % nscript_keys];
+    if (j % 5 == 0)
+        rep[3] = script_keys[(j + nscript_keys / 2) % nscript_keys];
+}
+
+/*
+ * Test mode script: boot reports and the key events each must produce
+ * under the default keymap (A and B swapped), written out by hand rather
+ * than derived from the decoding core.  Every step changes the key state
+ * so it yields exactly one evdev frame, in which the events may come in
+ * any order.  The last step releases everything and the script repeats.
+ */
+#define STEP_EVENTS 8
+
+struct test_step {
+    unsigned char rep[USB_KBD_BOOT_REPORT_LEN];
+    unsigned int nexp;
+    struct {
+        unsigned short code;
+        int value;
+    } exp[STEP_EVENTS];
+};
+
+static const struct test_step test_steps[] = {
+    /* Plain keys, with the A/B swap */
+    {{0, 0, 0x04}, 1, {{KEY_B, 1}}},
+    {{0, 0, 0x04, 0x05}, 1, {{KEY_A, 1}}},
+    {{0, 0, 0x05}, 1, {{KEY_B, 0}}},
+    {{0}, 1, {{KEY_A, 0}}},
+    /* Modifiers: bit n of byte 0 is usage 0xe0 + n */
+    {{0x02}, 1, {{KEY_LEFTSHIFT, 1}}},
+    {{0x02, 0, 0x06}, 1, {{KEY_C, 1}}},
+    {{0x00, 0, 0x06}, 1, {{KEY_LEFTSHIFT, 0}}},
+    {{0x11, 0, 0x06}, 2, {{KEY_LEFTCTRL, 1}, {KEY_RIGHTCTRL, 1}}},
+    {{0xff, 0, 0x06}, 6, {{KEY_LEFTSHIFT, 1}, {KEY_LEFTALT, 1}, {KEY_LEFTMETA, 1},
+                          {KEY_RIGHTSHIFT, 1}, {KEY_RIGHTALT, 1}, {KEY_RIGHTMETA, 1}}},
+    {{0x00, 0, 0x06}, 8, {{KEY_LEFTCTRL, 0}, {KEY_LEFTSHIFT, 0}, {KEY_LEFTALT, 0}, {KEY_LEFTMETA, 0},
+                          {KEY_RIGHTCTRL, 0}, {KEY_RIGHTSHIFT, 0}, {KEY_RIGHTALT, 0}, {KEY_RIGHTMETA, 0}}},
+    {{0}, 1, {{KEY_C, 0}}},
+    /* Rollover: six keys at once, then one moving through the slots */
+    {{0, 0, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23}, 6, {{KEY_1, 1}, {KEY_2, 1}, {KEY_3, 1},
+                                                     {KEY_4, 1}, {KEY_5, 1}, {KEY_6, 1}}},
+    {{0, 0, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24}, 2, {{KEY_1, 0}, {KEY_7, 1}}},
+    /* ErrorRollOver keeps the held keys; only the modifier byte counts */
+    {{0x02, 0, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01}, 1, {{KEY_LEFTSHIFT, 1}}},
+    {{0x00, 0, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24}, 1, {{KEY_LEFTSHIFT, 0}}},
+    /* Release all */
+    {{0}, 6, {{KEY_2, 0}, {KEY_3, 0}, {KEY_4, 0}, {KEY_5, 0}, {KEY_6, 0}, {KEY_7, 0}}},
+};
+
+#define NSTEPS (sizeof(test_steps) / sizeof(test_steps[0]))
+
+struct test {
+    struct gadget *g;
+    int evfd;
+    unsigned int count;
+    unsigned int rate;
+    unsigned long long *sent_ns;  /* just before the report was queued */
+    unsigned long long *stamp_ns; /* evdev timestamp of its frame */
+    unsigned long long *read_ns;  /* when the frame was read */
+    volatile unsigned int frames;
+    volatile bool done;
+    unsigned int mismatches;
+};
+
+static void test_alloc(struct test *t)
+{
+    t->sent_ns = calloc(t->count, sizeof(*t->sent_ns));
+    t->stamp_ns = calloc(t->count, sizeof(*t->stamp_ns));
+    t->read_ns = calloc(t->count, sizeof(*t->read_ns));
+    if (!t->sent_ns || !t->stamp_ns || !t->read_ns)
+        fail("malloc");
+}
+
+static void *test_reader(void *arg)
+{
+    struct test *t = arg;
+    struct input_event ev[64];
+    unsigned int got = 0, matched = 0, f, x;
+    const struct test_step *step;
+    int i, n;
+
+    while (t->frames < t->count && !t->done && !stop) {
+        n = read(t->evfd, ev, sizeof(ev));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("evdev read");
+            break;
+        }
+        for (i = 0; i < n / (int)sizeof(ev[0]) && t->frames < t->count; i++) {
+            f = t->frames;
+            step = &test_steps[f % NSTEPS];
+            if (ev[i].type == EV_KEY && ev[i].value != 2) {
+                for (x = 0; x < step->nexp; x++)
+                    if (!(matched & (1 << x)) && step->exp[x].code == ev[i].code &&
+                        step->exp[x].value == ev[i].value)
+                        break;
+                if (x < step->nexp)
+                    matched |= 1 << x;
+                else if (t->mismatches++ < 10)
+                    fprintf(stderr, "report %u: unexpected key %u value %d\n", f, ev[i].code, ev[i].value);
+                got++;
+            } else if (ev[i].type == EV_SYN && ev[i].code == SYN_REPORT) {
+                if ((got != step->nexp || matched != (1u << step->nexp) - 1) && t->mismatches++ < 10)
+                    fprintf(stderr, "report %u: %u key events, %u of the %u expected\n", f, got,
+                            __builtin_popcount(matched), step->nexp);
+                t->stamp_ns[f] = ev[i].input_event_sec * 1000000000ULL + ev[i].input_event_usec * 1000ULL;
+                t->read_ns[f] = now_ns();
+                t->frames = f + 1;
+                got = 0;
+                matched = 0;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * What the driver should send for the LEDs.  The built-in led_policy is
+ * modelled by hand on the MODE 0/1 behaviour it has to keep: a Num Lock
+ * change while Caps Lock is off enters mode 1, which holds the Caps Lock
+ * LED on until the next Num Lock change.  A custom policy loaded through
+ * sysfs is looked up in the same table the driver builds.
+ */
+struct led_model {
+    const struct usb_kbd_led_policy *policy; /* NULL for the built-in one */
+    unsigned int mode;
+    unsigned char newleds;
+};
+
+/* LED @code changed, giving the state @led */
+static void led_model_update(struct led_model *m, unsigned int code, unsigned int led)
+{
+    const struct usb_kbd_led_entry *e;
+    unsigned int num = led & 1, caps = (led >> 1) & 1;
+    unsigned char base;
+
+    if (m->policy) {
+        e = &m->policy->entry[m->mode][code][led & (USB_KBD_LED_STATES - 1)];
+        m->newleds = e->out;
+        m->mode = e->next;
+        return;
+    }
+
+    base = ((led >> 2) & 1) << 2 | num;
+    if (!m->mode && num != (m->newleds & 1) && !caps)
+        m->mode = 1;
+    else if (m->mode && num != (m->newleds & 1))
+        m->mode = 0;
+    m->newleds = base | (m->mode ? 2 : caps << 1);
+}
+
+/*
+ * Custom policy for the second LED pass, once as written to sysfs and
+ * once as the same rules applied to the core table.  Mode 1 falls back
+ * to mode 0, Scroll Lock also lights Num Lock, and Caps Lock on in mode 0
+ * enters mode 2, which shows only Scroll Lock until Caps Lock goes off.
+ */
+static const char custom_led_policy[] = "clear 1:*:*:*:0 *:2:*:+1:* 0:1:2/2:*:2 2:*:*:4:* 2:1:0/2:*:0\n";
+
+static void custom_led_model(struct usb_kbd_led_policy *p)
+{
+    usb_kbd_led_policy_clear(p);
+    usb_kbd_led_policy_set(p, 1, -1, 0, 0, -1, 0, 0);
+    usb_kbd_led_policy_set(p, -1, LED_SCROLLL, 0, 0, -1, 0x01, -1);
+    usb_kbd_led_policy_set(p, 0, LED_CAPSL, 0x02, 0x02, -1, 0, 2);
+    usb_kbd_led_policy_set(p, 2, -1, 0, 0, 0x04, 0, -1);
+    usb_kbd_led_policy_set(p, 2, LED_CAPSL, 0, 0x02, -1, 0, 0);
+}
+
+/* Write @policy to the led_policy attribute of the keyboard behind @evfd */
+static int write_led_policy(int evfd, const char *policy)
+{
+    char path[128];
+    struct stat st;
+    int fd, ret;
+
+    if (fstat(evfd, &st) < 0)
+        return -1;
+    snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/device/led_policy", major(st.st_rdev),
+             minor(st.st_rdev));
+    fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    ret = write(fd, policy, strlen(policy)) == (ssize_t)strlen(policy) ? 0 : -1;
+    if (ret)
+        perror(path);
+    close(fd);
+    return ret;
+}
+
+static void set_led(int fd, unsigned int code, unsigned int value)
+{
+    struct input_event ev[2];
+
+    memset(ev, 0, sizeof(ev));
+    ev[0].type = EV_LED;
+    ev[0].code = code;
+    ev[0].value = value;
+    ev[1].type = EV_SYN;
+    ev[1].code = SYN_REPORT;
+    if (write(fd, ev, sizeof(ev)) != sizeof(ev))
+        perror("evdev write");
+}
+
+static bool wait_leds(struct gadget *g, unsigned char want)
+{
+    unsigned long long deadline = now_ns() + 1000000000ULL;
+
+    while (now_ns() < deadline) {
+        if (g->leds[0] == want)
+            return true;
+        usleep(1000);
+    }
+    return false;
+}
+
+/* Walk @led through the LED states and check the SET_REPORT after each step */
+static unsigned int walk_leds(struct test *t, struct led_model *m, unsigned int *led, const char *pass)
+{
+    static const unsigned char steps[] = {0, 1, 3, 2, 6, 4, 5, 7, 3, 0, 1, 0};
+    static const unsigned int codes[] = {LED_NUML, LED_CAPSL, LED_SCROLLL};
+    unsigned int i, b, failures = 0;
+
+    for (i = 0; i < sizeof(steps); i++) {
+        for (b = 0; b < 3; b++) {
+            if (((*led ^ steps[i]) >> b) & 1) {
+                *led ^= 1 << b;
+                set_led(t->evfd, codes[b], (*led >> b) & 1);
+                led_model_update(m, codes[b], *led);
+            }
+        }
+        if (!wait_leds(t->g, m->newleds)) {
+            fprintf(stderr, "LED %s step %u (state %#x): device has %#x, expected %#x\n", pass, i, steps[i],
+                    t->g->leds[0], m->newleds);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+/*
+ * Walk the LED states through evdev and check every SET_REPORT the gadget
+ * gets, first under the built-in policy, then under a custom one
+ */
+static unsigned int test_leds(struct test *t)
+{
+    struct usb_kbd_led_policy custom;
+    unsigned long ledbits = 0;
+    unsigned int led, failures = 0;
+    struct led_model m = {0};
+
+    ioctl(t->evfd, EVIOCGLED(sizeof(ledbits)), &ledbits);
+    led = ledbits & 7;
+
+    /* Caps Lock on, then a Num Lock toggle always lands the driver in mode 0 */
+    if (!(led & 2))
+        set_led(t->evfd, LED_CAPSL, 1);
+    led |= 2;
+    led ^= 1;
+    set_led(t->evfd, LED_NUML, led & 1);
+    m.newleds = led & 7;
+    if (!wait_leds(t->g, m.newleds)) {
+        fprintf(stderr, "LED sync: device has %#x, expected %#x\n", t->g->leds[0], m.newleds);
+        failures++;
+    }
+    failures += walk_leds(t, &m, &led, "default");
+
+    /* The driver keeps its mode across a policy write; so does the model */
+    custom_led_model(&custom);
+    if (write_led_policy(t->evfd, custom_led_policy))
+        return failures + 1;
+    m.policy = &custom;
+    failures += walk_leds(t, &m, &led, "custom");
+    if (write_led_policy(t->evfd, "default\n"))
+        failures++;
+    return failures;
+}
+
+/* The device must advertise exactly the keycodes the translation table produces */
+static unsigned int test_keybits(int fd)
+{
+    unsigned long bits[(KEY_CNT + 8 * sizeof(long) - 1) / (8 * sizeof(long))];
+    unsigned int k, sc, bpl = 8 * sizeof(long), failures = 0;
+    bool produced[KEY_CNT];
+
+    memset(produced, 0, sizeof(produced));
+    for (sc = 0; sc < USB_KBD_KEYMAP_SIZE; sc++)
+        produced[usb_kbd_keycode[sc]] = true;
+    memset(bits, 0, sizeof(bits));
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(bits)), bits) < 0) {
+        perror("EVIOCGBIT");
+        return 1;
+    }
+    for (k = 1; k < KEY_CNT; k++) {
+        bool want = produced[k], have = (bits[k / bpl] >> (k % bpl)) & 1;
+
+        if (want != have) {
+            fprintf(stderr, "keycode %u: %s\n", k, want ? "produced but not advertised" : "advertised but never produced");
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void print_percentiles(const char *name, unsigned long long *v, unsigned int n)
+{
+    if (!n)
+        return;
+    qsort(v, n, sizeof(*v), cmp_ull);
+    printf("%-16s p50 %7.1f us  p90 %7.1f us  p99 %7.1f us  max %7.1f us\n", name,
+           v[n / 2] / 1000.0, v[n * 90 / 100] / 1000.0, v[n * 99 / 100] / 1000.0, v[n - 1] / 1000.0);
+}
+
+static int run_test(struct gadget *g, unsigned int count, unsigned int rate)
+{
+    struct test t = {.g = g, .count = count, .rate = rate};
+    unsigned char rep[USB_KBD_BOOT_REPORT_LEN];
+    unsigned long long start, next, end, *lat;
+    unsigned int i, n, led_failures, key_failures;
+    pthread_t reader;
+    int clk = CLOCK_MONOTONIC;
+
+    test_alloc(&t);
+
+    for (i = 0; i < 100 && (t.evfd = find_evdev(g->index)) < 0; i++)
+        usleep(100000);
+    if (t.evfd < 0) {
+        fprintf(stderr, "usbkbd did not bind to the virtual keyboard\n");
+        return EXIT_FAILURE;
+    }
+    /* Keep the scripted typing away from the console and the desktop */
+    if (ioctl(t.evfd, EVIOCGRAB, 1) < 0)
+        perror("EVIOCGRAB");
+    ioctl(t.evfd, EVIOCSCLOCKID, &clk);
+    while (!g->configured)
+        usleep(1000);
+
+    if (pthread_create(&reader, NULL, test_reader, &t))
+        fail("pthread_create");
+
+    start = next = now_ns();
+    for (i = 0; i < count && !stop; i++) {
+        memcpy(rep, test_steps[i % NSTEPS].rep, sizeof(rep));
+        t.sent_ns[i] = now_ns();
+        if (ep_write(g, 0, rep, sizeof(rep)) < 0) {
+            perror("ep write");
+            break;
+        }
+        next += 1000000000ULL / rate;
+        while (now_ns() < next)
+            ;
+    }
+    end = now_ns();
+
+    /* Give the last frames a moment, then stop the reader */
+    for (n = 0; n < 1000 && t.frames < i; n++)
+        usleep(1000);
+    t.done = true;
+    pthread_kill(reader, SIGUSR1);
+    pthread_join(reader, NULL);
+
+    led_failures = test_leds(&t);
+    key_failures = test_keybits(t.evfd);
+
+    printf("reports:         %u sent, %u frames received, %u mismatches\n", i, t.frames, t.mismatches);
+    printf("throughput:      %.0f reports/s (requested %u)\n", i * 1e9 / (end - start), rate);
+    printf("LED checks:      %u failed, %lu SET_REPORTs seen\n", led_failures, g->led_reports);
+    printf("key bits:        %u mismatched\n", key_failures);
+
+    n = t.frames;
+    lat = malloc(sizeof(*lat) * (n + 1));
+    if (lat) {
+        for (i = 0; i < n; i++)
+            lat[i] = t.stamp_ns[i] > t.sent_ns[i] ? t.stamp_ns[i] - t.sent_ns[i] : 0;
+        print_percentiles("queue->stamp:", lat, n);
+        for (i = 0; i < n; i++)
+            lat[i] = t.read_ns[i] - t.sent_ns[i];
+        print_percentiles("queue->read:", lat, n);
+        free(lat);
+    }
+
+    close(t.evfd);
+    return t.frames == count && !t.mismatches && !led_failures && !key_failures ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void run_play(struct gadget *g, unsigned int count, unsigned int rate, unsigned int delay)
+{
+    u16 keymap[USB_KBD_KEYMAP_SIZE];
+    unsigned char rep[USB_KBD_BOOT_REPORT_LEN];
+    struct timespec next;
+    unsigned int i;
+
+    usb_kbd_core_default_keymap(keymap);
+    script_init(keymap);
+    while (!g->configured && !stop)
+        usleep(1000);
+    /* Time for a script to set a harmless keymap before anything is typed */
+    sleep(delay);
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (i = 0; (!count || i < count) && !stop; i++) {
+        script_report(i, rep);
+        if (ep_write(g, 0, rep, sizeof(rep)) < 0) {
+            perror("ep write");
+            break;
+        }
+        /* Sleep rather than spin: the point is to leave the CPU to what is measured */
+        next.tv_nsec += 1000000000L / rate;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    printf("%u reports played\n", i);
+}
+
+static void on_signal(int sig)
+{
+    if (sig != SIGUSR1)
+        stop = 1;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-g gadgets] [-k keyboards-per-gadget] [-i bInterval] [-S full|high]\n"
+                    "          [-u udc-driver] [-t|-p [-D delay-s] [-n reports] [-r reports/s]]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    static struct gadget gadgets[MAX_GADGETS];
+    unsigned int ngadgets = 1, nkbds = 1, i;
+    unsigned int count = 10000, rate = 1000, delay = 0;
+    bool test = false, play = false;
+    struct sigaction sa;
+    int opt, ret = EXIT_SUCCESS;
+
+    while ((opt = getopt(argc, argv, "g:k:i:n:r:S:tpD:u:")) != -1) {
+        switch (opt) {
+        case 'g':
+            ngadgets = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            nkbds = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            interval = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            speed = strcmp(optarg, "full") ? USB_SPEED_HIGH : USB_SPEED_FULL;
+            break;
+        case 't':
+            test = true;
+            break;
+        case 'p':
+            play = true;
+            break;
+        case 'D':
+            delay = strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            udc_driver = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (!interval)
+        interval = speed == USB_SPEED_HIGH ? 4 : 1;
+    if (!ngadgets || ngadgets > MAX_GADGETS || !nkbds || nkbds > MAX_KBDS || (!count && !play) || !rate)
+        usage(argv[0]);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL); /* interrupts blocking reads */
+
+    for (i = 0; i < ngadgets; i++) {
+        gadgets[i].index = i;
+        gadgets[i].nkbds = nkbds;
+        gadget_start(&gadgets[i]);
+    }
+    printf("%u gadgets, %u keyboards\n", ngadgets, ngadgets * nkbds);
+    fflush(stdout);
+
+    if (test)
+        ret = run_test(&gadgets[0], count, rate);
+    else {
+        if (play)
+            run_play(&gadgets[0], count, rate, delay);
+        while (!stop)
+            pause();
+    }
+
+    for (i = 0; i < ngadgets; i++) {
+        pthread_kill(gadgets[i].thread, SIGINT);
+        pthread_join(gadgets[i].thread, NULL);
+        close(gadgets[i].fd);
+    }
+    return ret;
+}
@@ -0,0 +1,270 @@
+/*
+ * Hotkey client for the usbkbd hotkey engine.
+ *
+ * The old hotkey daemons (CtrlC.c, print_message.c, toggle_led.c) each
+ * read every event from evdev to find one key.  Here the chords are
+ * loaded into the driver and the process only wakes when one fires.
+ *
+ *   sudo ./kbd_hotkey k ctrl+u d:release       print chords as they fire
+ *   sudo ./kbd_hotkey -b -N 8 -s 10 /dev/input/event5 k
+ *                                              benchmark against evdev readers
+ *
+ * A chord is [ctrl+][shift+][alt+][meta+]<key>[:press|:release|:both]
+ * where key is a letter, a digit or a keycode number; "any+" matches
+ * whatever modifiers are held.  The benchmark runs N read-every-event
+ * subscribers on the evdev node, then N hotkey subscribers, for the
+ * given number of seconds each while something types, and prints their
+ * wakeups (voluntary context switches) and CPU time.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <linux/input.h>
+
+#include "usbkbd_hotkey.h"
+
+#define HOTKEY_DEV "/dev/usbkbd_hotkey"
+
+static const unsigned short letter_keys[26] = {
+    KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J, KEY_K, KEY_L, KEY_M,
+    KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
+};
+
+static int parse_chord(const char *arg, struct usb_kbd_hotkey *hk)
+{
+    static const struct {
+        const char *name;
+        unsigned char mod;
+    } mods[] = {
+        {"ctrl+", USB_KBD_HOTKEY_CTRL},
+        {"shift+", USB_KBD_HOTKEY_SHIFT},
+        {"alt+", USB_KBD_HOTKEY_ALT},
+        {"meta+", USB_KBD_HOTKEY_META},
+    };
+    const char *p = arg, *edge;
+    char key[16];
+    unsigned int i;
+    size_t len;
+
+    memset(hk, 0, sizeof(*hk));
+    for (;;) {
+        for (i = 0; i < sizeof(mods) / sizeof(mods[0]); i++)
+            if (!strncmp(p, mods[i].name, strlen(mods[i].name)))
+                break;
+        if (i < sizeof(mods) / sizeof(mods[0])) {
+            hk->mods |= mods[i].mod;
+            p += strlen(mods[i].name);
+        } else if (!strncmp(p, "any+", 4)) {
+            hk->flags |= USB_KBD_HOTKEY_ANY_MODS;
+            p += 4;
+        } else {
+            break;
+        }
+    }
+
+    edge = strchr(p, ':');
+    len = edge ? (size_t)(edge - p) : strlen(p);
+    if (!len || len >= sizeof(key))
+        return -1;
+    memcpy(key, p, len);
+    key[len] = 0;
+
+    if (!edge || !strcmp(edge, ":press"))
+        hk->flags |= USB_KBD_HOTKEY_PRESS;
+    else if (!strcmp(edge, ":release"))
+        hk->flags |= USB_KBD_HOTKEY_RELEASE;
+    else if (!strcmp(edge, ":both"))
+        hk->flags |= USB_KBD_HOTKEY_PRESS | USB_KBD_HOTKEY_RELEASE;
+    else
+        return -1;
+
+    if (len == 1 && key[0] >= 'a' && key[0] <= 'z')
+        hk->keycode = letter_keys[key[0] - 'a'];
+    else if (len == 1 && key[0] >= '1' && key[0] <= '9')
+        hk->keycode = KEY_1 + key[0] - '1';
+    else if (len == 1 && key[0] == '0')
+        hk->keycode = KEY_0;
+    else
+        hk->keycode = strtoul(key, NULL, 0);
+    return hk->keycode && hk->keycode <= KEY_MAX ? 0 : -1;
+}
+
+/* Open a subscriber and load @n chords; chord i gets id i */
+static int hotkey_open(const struct usb_kbd_hotkey *chords, unsigned int n)
+{
+    unsigned int i;
+    int fd;
+
+    fd = open(HOTKEY_DEV, O_RDONLY);
+    if (fd < 0) {
+        perror(HOTKEY_DEV);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        struct usb_kbd_hotkey hk = chords[i];
+
+        hk.id = i;
+        if (ioctl(fd, USB_KBD_IOC_ADD_HOTKEY, &hk) < 0) {
+            perror("USB_KBD_IOC_ADD_HOTKEY");
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+/* The old way: read every event, one at a time, and compare */
+static void evdev_subscriber(const char *path, const struct usb_kbd_hotkey *hk, unsigned long long *matches)
+{
+    struct input_event ev;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        perror(path);
+        _exit(EXIT_FAILURE);
+    }
+    while (read(fd, &ev, sizeof(ev)) == sizeof(ev))
+        if (ev.type == EV_KEY && ev.code == hk->keycode && ev.value == 1)
+            __atomic_fetch_add(matches, 1, __ATOMIC_RELAXED);
+    _exit(EXIT_FAILURE);
+}
+
+static void hotkey_subscriber(const struct usb_kbd_hotkey *hk, unsigned long long *matches)
+{
+    struct usb_kbd_hotkey_event ev[16];
+    ssize_t n;
+    int fd = hotkey_open(hk, 1);
+
+    if (fd < 0)
+        _exit(EXIT_FAILURE);
+    while ((n = read(fd, ev, sizeof(ev))) > 0)
+        __atomic_fetch_add(matches, n / sizeof(ev[0]), __ATOMIC_RELAXED);
+    _exit(EXIT_FAILURE);
+}
+
+static void bench_phase(const char *name, const char *evdev, const struct usb_kbd_hotkey *hk,
+                        unsigned int nsubs, unsigned int secs, unsigned long long *matches)
+{
+    unsigned long long wakeups = 0, cpu_us = 0, total;
+    pid_t pids[256];
+    struct rusage ru;
+    unsigned int i;
+
+    *matches = 0;
+    for (i = 0; i < nsubs; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+        if (!pids[i]) {
+            if (evdev)
+                evdev_subscriber(evdev, hk, matches);
+            hotkey_subscriber(hk, matches);
+        }
+    }
+
+    sleep(secs);
+    total = __atomic_load_n(matches, __ATOMIC_RELAXED);
+    for (i = 0; i < nsubs; i++)
+        kill(pids[i], SIGTERM);
+    for (i = 0; i < nsubs; i++) {
+        if (wait4(pids[i], NULL, 0, &ru) < 0)
+            continue;
+        wakeups += ru.ru_nvcsw;
+        cpu_us += ru.ru_utime.tv_sec * 1000000ULL + ru.ru_utime.tv_usec +
+                  ru.ru_stime.tv_sec * 1000000ULL + ru.ru_stime.tv_usec;
+    }
+
+    printf("%-7s %3u subscribers %8llu matches %9llu wakeups %8.1f ms CPU %8.1f wakeups/match\n", name,
+           nsubs, total, wakeups, cpu_us / 1000.0, total ? (double)wakeups / total : 0.0);
+}
+
+static int bench(const char *evdev, const struct usb_kbd_hotkey *hk, unsigned int nsubs, unsigned int secs)
+{
+    unsigned long long *matches;
+
+    matches = mmap(NULL, sizeof(*matches), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (matches == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    printf("keycode %u, %u s per phase\n", hk->keycode, secs);
+    bench_phase("evdev", evdev, hk, nsubs, secs, matches);
+    bench_phase("hotkey", NULL, hk, nsubs, secs, matches);
+    return EXIT_SUCCESS;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s chord...\n"
+                    "       %s -b [-N subscribers] [-s seconds] <evdev> <chord>\n",
+            prog, prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    struct usb_kbd_hotkey chords[USB_KBD_HOTKEY_MAX];
+    struct usb_kbd_hotkey_event ev[16];
+    unsigned int nsubs = 8, secs = 10, n = 0, i;
+    bool benchmark = false;
+    ssize_t len;
+    int fd, opt;
+
+    while ((opt = getopt(argc, argv, "bN:s:")) != -1) {
+        switch (opt) {
+        case 'b':
+            benchmark = true;
+            break;
+        case 'N':
+            nsubs = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            secs = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (benchmark) {
+        if (optind != argc - 2 || !nsubs || nsubs > 256 || !secs)
+            usage(argv[0]);
+        if (parse_chord(argv[optind + 1], &chords[0])) {
+            fprintf(stderr, "bad chord: %s\n", argv[optind + 1]);
+            return EXIT_FAILURE;
+        }
+        return bench(argv[optind], &chords[0], nsubs, secs);
+    }
+
+    if (optind == argc || argc - optind > USB_KBD_HOTKEY_MAX)
+        usage(argv[0]);
+    for (i = optind; i < argc; i++)
+        if (parse_chord(argv[i], &chords[n++])) {
+            fprintf(stderr, "bad chord: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+
+    fd = hotkey_open(chords, n);
+    if (fd < 0)
+        return EXIT_FAILURE;
+    while ((len = read(fd, ev, sizeof(ev))) > 0) {
+        for (i = 0; i < len / sizeof(ev[0]); i++)
+            printf("%llu.%06llu %s %s\n", (unsigned long long)ev[i].ns / 1000000000ULL,
+                   (unsigned long long)ev[i].ns % 1000000000ULL / 1000, argv[optind + ev[i].id],
+                   ev[i].value ? "press" : "release");
+        fflush(stdout);
+    }
+    perror("read");
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,355 @@
+/*
+ * Userspace key remapper for usbkbd keyboards.
+ *
+ * Grabs every usbkbd keyboard (or the one given with -d) so the original
+ * keys go nowhere else, runs each frame through a keycode table and
+ * writes the result to a uinput device with one write() per frame.
+ *
+ *   sudo ./kbd_remap a:b b:a                  swap A and B
+ *   sudo ./kbd_remap -P 50 58:29 29:0         Caps Lock -> Ctrl, Ctrl off
+ *   sudo ./kbd_remap -t 10000 a:b             latency self-test, 10000 frames
+ *
+ * A mapping is from:to, each a letter, a digit or a keycode number; to 0
+ * drops the key.  -P runs the loop SCHED_FIFO at that priority with its
+ * memory locked.  The self-test tags every frame it writes, reads the
+ * frames back from the uinput device's evdev node and prints how long
+ * after the keyboard's own timestamp they were written and delivered.
+ * The in-driver keymap (the sysfs keymap attribute) costs no extra hop,
+ * so the delivered column is what userspace remapping adds on top.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/uinput.h>
+
+#include "kbd_evdev.h"
+
+#define REMAP_NAME "usbkbd remap"
+#define STAMP_RING 1024
+
+static unsigned short keymap[KEY_CNT];
+static struct kbd_evdev *kd;
+static int uinput_fd = -1;
+
+/* Self-test: input timestamp of the frame tagged seq at in_ns[seq % STAMP_RING] */
+static unsigned long long selftest, written, delivered;
+static unsigned int seq;
+static unsigned long long in_ns[STAMP_RING];
+static unsigned long long *written_lat, *delivered_lat;
+static pthread_t main_thread;
+
+/* One frame in, at most one frame plus the self-test tag out */
+static struct input_event out[KBD_EVDEV_BATCH + 1];
+
+static const unsigned short letter_keys[26] = {
+    KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J, KEY_K, KEY_L, KEY_M,
+    KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
+};
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long event_ns(const struct input_event *ev)
+{
+    return (unsigned long long)ev->input_event_sec * 1000000000ULL + ev->input_event_usec * 1000ULL;
+}
+
+static int parse_key(const char *s, size_t len)
+{
+    char buf[16];
+    char *end;
+    long k;
+
+    if (len == 1 && s[0] >= 'a' && s[0] <= 'z')
+        return letter_keys[s[0] - 'a'];
+    if (len == 1 && s[0] >= '1' && s[0] <= '9')
+        return KEY_1 + s[0] - '1';
+    if (len == 1 && s[0] == '0')
+        return KEY_0;
+    if (!len || len >= sizeof(buf))
+        return -1;
+    memcpy(buf, s, len);
+    buf[len] = 0;
+    k = strtol(buf, &end, 0);
+    return *end || k < 0 || k > KEY_MAX ? -1 : k;
+}
+
+static int parse_mapping(const char *arg)
+{
+    const char *colon = strchr(arg, ':');
+    int from, to;
+
+    if (!colon)
+        return -1;
+    from = parse_key(arg, colon - arg);
+    to = parse_key(colon + 1, strlen(colon + 1));
+    if (from <= 0 || to < 0)
+        return -1;
+    keymap[from] = to;
+    return 0;
+}
+
+static int remap_frame(int fd, const struct input_event *ev, unsigned int n, void *arg)
+{
+    unsigned long long stamp = event_ns(&ev[n - 1]);
+    unsigned int i, nout = 0;
+
+    for (i = 0; i < n; i++) {
+        if (ev[i].type == EV_KEY) {
+            if (!keymap[ev[i].code])
+                continue;
+            out[nout] = ev[i];
+            out[nout++].code = keymap[ev[i].code];
+        } else if (ev[i].type != EV_SYN) {
+            out[nout++] = ev[i];
+        }
+    }
+    /* The input core would swallow a frame with nothing but SYN_REPORT */
+    if (!nout)
+        return 0;
+
+    if (selftest) {
+        memset(&out[nout], 0, sizeof(out[nout]));
+        out[nout].type = EV_MSC;
+        out[nout].code = MSC_SCAN;
+        out[nout++].value = seq;
+        in_ns[seq % STAMP_RING] = stamp;
+    }
+    out[nout++] = ev[n - 1];
+
+    if (write(uinput_fd, out, nout * sizeof(out[0])) != (ssize_t)(nout * sizeof(out[0]))) {
+        perror("uinput write");
+        return 1;
+    }
+    if (selftest) {
+        if (written < selftest)
+            written_lat[written++] = now_ns() - stamp;
+        seq++;
+    }
+    return 0;
+}
+
+static int uinput_create(int msc)
+{
+    unsigned long bits[KEY_CNT / (8 * sizeof(long)) + 1];
+    struct uinput_setup setup;
+    unsigned int i, k;
+    int fd, src;
+
+    fd = open("/dev/uinput", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("/dev/uinput");
+        return -1;
+    }
+    ioctl(fd, UI_SET_EVBIT, EV_SYN);
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    if (msc) {
+        ioctl(fd, UI_SET_EVBIT, EV_MSC);
+        ioctl(fd, UI_SET_MSCBIT, MSC_SCAN);
+    }
+
+    /* Every key the keyboards have, as it comes out of the table */
+    for (i = 0; (src = kbd_evdev_fd(kd, i)) >= 0; i++) {
+        memset(bits, 0, sizeof(bits));
+        if (ioctl(src, EVIOCGBIT(EV_KEY, sizeof(bits)), bits) < 0)
+            continue;
+        for (k = 1; k < KEY_CNT; k++)
+            if (bits[k / (8 * sizeof(long))] >> (k % (8 * sizeof(long))) & 1 && keymap[k])
+                ioctl(fd, UI_SET_KEYBIT, keymap[k]);
+    }
+
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    snprintf(setup.name, sizeof(setup.name), REMAP_NAME);
+    if (ioctl(fd, UI_DEV_SETUP, &setup) || ioctl(fd, UI_DEV_CREATE)) {
+        perror("uinput setup");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* The event node udev will create for the uinput device */
+static int uinput_evdev(char *path, size_t len)
+{
+    char sysname[64], dir[128];
+    struct dirent *de;
+    DIR *d;
+
+    if (ioctl(uinput_fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0)
+        return -1;
+    snprintf(dir, sizeof(dir), "/sys/devices/virtual/input/%s", sysname);
+    d = opendir(dir);
+    if (!d)
+        return -1;
+    while ((de = readdir(d)))
+        if (!strncmp(de->d_name, "event", 5))
+            break;
+    if (de)
+        snprintf(path, len, "/dev/input/%.*s", (int)len - 12, de->d_name);
+    closedir(d);
+    return de ? 0 : -1;
+}
+
+/* Self-test: read the remapped frames back and match them by their tag */
+static void *selftest_reader(void *arg)
+{
+    struct input_event ev[64];
+    int fd = *(int *)arg, clock = CLOCK_MONOTONIC;
+    unsigned int tag = 0;
+    ssize_t len;
+    int i, tagged = 0;
+
+    ioctl(fd, EVIOCSCLOCKID, &clock);
+    while (delivered < selftest && (len = read(fd, ev, sizeof(ev))) > 0) {
+        for (i = 0; i < len / (ssize_t)sizeof(ev[0]) && delivered < selftest; i++) {
+            if (ev[i].type == EV_MSC && ev[i].code == MSC_SCAN) {
+                tag = ev[i].value;
+                tagged = 1;
+            } else if (ev[i].type == EV_SYN && ev[i].code == SYN_REPORT && tagged) {
+                delivered_lat[delivered++] = event_ns(&ev[i]) - in_ns[tag % STAMP_RING];
+                tagged = 0;
+            }
+        }
+    }
+    pthread_kill(main_thread, SIGTERM);
+    return NULL;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void print_lat(const char *name, unsigned long long *v, unsigned long long n)
+{
+    qsort(v, n, sizeof(v[0]), cmp_ull);
+    printf("%-18s p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", name, v[n / 2] / 1000.0, v[n * 99 / 100] / 1000.0,
+           v[n - 1] / 1000.0);
+}
+
+static void on_signal(int sig)
+{
+    kbd_evdev_stop(kd);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d evdev] [-P fifo-priority] [-t frames] from:to...\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa = {.sa_handler = on_signal};
+    const char *dev = NULL;
+    char out_path[KBD_EVDEV_PATH];
+    pthread_t reader;
+    int opt, prio = 0, out_fd = -1, ret, i;
+
+    while ((opt = getopt(argc, argv, "d:P:t:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dev = optarg;
+            break;
+        case 'P':
+            prio = atoi(optarg);
+            break;
+        case 't':
+            selftest = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc)
+        usage(argv[0]);
+
+    for (i = 0; i < KEY_CNT; i++)
+        keymap[i] = i;
+    for (i = optind; i < argc; i++)
+        if (parse_mapping(argv[i])) {
+            fprintf(stderr, "bad mapping: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+
+    kd = kbd_evdev_open(dev, O_RDONLY);
+    if (!kd)
+        return EXIT_FAILURE;
+    uinput_fd = uinput_create(selftest != 0);
+    if (uinput_fd < 0)
+        return EXIT_FAILURE;
+
+    if (selftest) {
+        written_lat = calloc(selftest, sizeof(*written_lat));
+        delivered_lat = calloc(selftest, sizeof(*delivered_lat));
+        if (!written_lat || !delivered_lat) {
+            perror("calloc");
+            return EXIT_FAILURE;
+        }
+        /* udev creates the node shortly after UI_DEV_CREATE */
+        for (i = 0; i < 100 && (uinput_evdev(out_path, sizeof(out_path)) ||
+                                (out_fd = open(out_path, O_RDONLY | O_CLOEXEC)) < 0); i++)
+            usleep(10000);
+        if (out_fd < 0) {
+            fprintf(stderr, "cannot open the evdev node of " REMAP_NAME "\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (prio) {
+        struct sched_param sp = {.sched_priority = prio};
+
+        if (sched_setscheduler(0, SCHED_FIFO, &sp) || mlockall(MCL_CURRENT | MCL_FUTURE)) {
+            perror("SCHED_FIFO");
+            return EXIT_FAILURE;
+        }
+    }
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    main_thread = pthread_self();
+    if (selftest && pthread_create(&reader, NULL, selftest_reader, &out_fd)) {
+        perror("pthread_create");
+        return EXIT_FAILURE;
+    }
+
+    if (kbd_evdev_grab(kd, 1))
+        return EXIT_FAILURE;
+    ret = kbd_evdev_run(kd, remap_frame, NULL);
+    kbd_evdev_grab(kd, 0);
+    if (ret < 0)
+        fprintf(stderr, "read: %s\n", strerror(-ret));
+
+    if (selftest) {
+        pthread_cancel(reader);
+        pthread_join(reader, NULL);
+        if (written && delivered) {
+            printf("%llu frames\n", delivered);
+            print_lat("input -> write()", written_lat, written);
+            print_lat("input -> delivered", delivered_lat, delivered);
+        }
+    }
+
+    ioctl(uinput_fd, UI_DEV_DESTROY);
+    close(uinput_fd);
+    kbd_evdev_close(kd);
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,426 @@
+/*
+ * Userspace replay benchmark for the usbkbd decoding core.
+ *
+ * Feeds a stream of raw reports through usb_kbd_core_process(), the
+ * same code the driver runs in its URB completion handler, and prints
+ * ns/report, events emitted and heap allocations made while decoding.
+ *
+ *   ./kbd_replay                      synthetic typing stream
+ *   ./kbd_replay -f reports.bin       replay raw 8-byte reports from a file
+ *   ./kbd_replay -n 1000000 -r 20     report count / number of passes
+ *   ./kbd_replay -N                   synthetic NKRO (report protocol) stream
+ *   ./kbd_replay -d desc.bin -f r.bin replay reports laid out by a HID
+ *                                     report descriptor
+ *   ./kbd_replay -b 30                run the 30 ms debounce filter too,
+ *                                     reports taken 1 ms apart
+ *
+ * Before timing anything it checks that the modifier byte of a boot
+ * report decodes to the eight modifier keys, and that ErrorRollOver keeps
+ * the held keys but still takes the modifiers from the report.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input-event-codes.h>
+
+#include "usbkbd_core.h"
+
+/* Linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc */
+static unsigned long alloc_count;
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int xorshift32(unsigned int *state)
+{
+    unsigned int x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/* Boot protocol report expressed as a layout, used to encode synthetic reports */
+static const struct usb_kbd_layout boot_layout = {
+    .report_len = USB_KBD_BOOT_REPORT_LEN,
+    .nbitfields = 1,
+    .bitfields = {{0, USB_KBD_MOD_USAGE, 8}},
+    .array_offset = 16,
+    .array_count = USB_KBD_BOOT_KEYS,
+};
+
+/*
+ * Typical NKRO keyboard: report ID 1, modifier bits, a reserved byte and a
+ * 160-bit bitmap covering usages 0x00..0x9f.
+ */
+static const unsigned char nkro_desc[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x85, 0x01,
+    0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x75, 0x08, 0x95, 0x01, 0x81, 0x01,
+    0x05, 0x07, 0x19, 0x00, 0x29, 0x9f, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0xa0, 0x81, 0x02,
+    0xc0,
+};
+
+static void set_report_bit(unsigned char *rep, unsigned int bit)
+{
+    rep[bit >> 3] |= 1 << (bit & 7);
+}
+
+/* Encode modifiers and held usages as a report in @layout; unrepresentable usages are dropped */
+static void encode_report(const struct usb_kbd_layout *layout, unsigned char *rep,
+                          unsigned char mods, const unsigned char *held, unsigned int nheld)
+{
+    unsigned int slot = 0, i, f;
+
+    memset(rep, 0, layout->report_len);
+    if (layout->report_id)
+        rep[0] = layout->report_id;
+
+    for (i = 0; i < 8 + nheld; i++) {
+        unsigned int usage;
+        bool placed = false;
+
+        if (i < 8) {
+            if (!(mods & (1 << i)))
+                continue;
+            usage = USB_KBD_MOD_USAGE + i;
+        } else {
+            usage = held[i - 8];
+        }
+
+        for (f = 0; f < layout->nbitfields && !placed; f++) {
+            const struct usb_kbd_bitfield *bf = &layout->bitfields[f];
+
+            if (usage >= bf->first_usage && usage < bf->first_usage + bf->count) {
+                set_report_bit(rep, bf->bit_offset + usage - bf->first_usage);
+                placed = true;
+            }
+        }
+        if (!placed && slot < layout->array_count && usage >= layout->array_base)
+            rep[layout->array_offset / 8 + slot++] = usage - layout->array_base;
+    }
+}
+
+/*
+ * Synthetic stream: overlapping keystrokes with up to @maxheld keys held,
+ * random modifiers, the occasional unmapped scancode.
+ */
+static unsigned char *make_synthetic(const struct usb_kbd_layout *layout, size_t count,
+                                     unsigned int maxheld, unsigned int seed)
+{
+    unsigned char *buf = malloc(count * layout->report_len);
+    unsigned char held[32] = {0};
+    unsigned int nheld = 0;
+    size_t r;
+
+    if (!buf)
+        return NULL;
+
+    for (r = 0; r < count; r++) {
+        unsigned int rnd = xorshift32(&seed);
+
+        if (nheld && (nheld == maxheld || (rnd & 1))) {
+            unsigned int victim = (rnd >> 1) % nheld;
+
+            held[victim] = held[--nheld];
+        } else {
+            unsigned char sc = 4 + (rnd >> 8) % 0x61;
+            unsigned int i;
+
+            if ((rnd >> 24) == 0)
+                sc = 0xa5 + (rnd >> 16) % 8; /* unmapped range */
+            for (i = 0; i < nheld && held[i] != sc; i++)
+                ;
+            if (i == nheld)
+                held[nheld++] = sc;
+        }
+
+        encode_report(layout, buf + r * layout->report_len, (rnd >> 20) & 0x22, held, nheld);
+    }
+    return buf;
+}
+
+static unsigned char *load_file(const char *path, size_t reclen, size_t *count)
+{
+    FILE *f = fopen(path, "rb");
+    unsigned char *buf;
+    long size;
+
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    *count = size / reclen;
+    buf = malloc(*count * reclen + 1);
+    if (buf && fread(buf, reclen, *count, f) != *count) {
+        perror(path);
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+/* Usages 0xe0..0xe7, written out rather than read back from usb_kbd_keycode[] */
+static const u16 modifier_keys[8] = {
+    KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_LEFTMETA,
+    KEY_RIGHTCTRL, KEY_RIGHTSHIFT, KEY_RIGHTALT, KEY_RIGHTMETA,
+};
+
+static bool check_modifiers(const u16 *keymap)
+{
+    static const unsigned char report[USB_KBD_BOOT_REPORT_LEN] = {0xff};
+    struct usb_kbd_event events[USB_KBD_CORE_MAX_EVENTS];
+    struct usb_kbd_core core;
+    unsigned int i, n, seen = 0;
+    bool ok = true;
+
+    usb_kbd_core_init(&core);
+    n = usb_kbd_core_process(&core, keymap, report, events);
+    for (i = 0; i < n; i++) {
+        unsigned int bit = events[i].scancode - USB_KBD_MOD_USAGE;
+
+        if (events[i].scancode < USB_KBD_MOD_USAGE || bit >= 8 || !events[i].value ||
+            events[i].code != modifier_keys[bit]) {
+            fprintf(stderr, "modifier check: usage %#04x decoded to keycode %u value %d\n",
+                    events[i].scancode, events[i].code, events[i].value);
+            ok = false;
+            continue;
+        }
+        seen |= 1 << bit;
+    }
+    if (seen != 0xff) {
+        fprintf(stderr, "modifier check: no press for modifier bits %#04x\n", ~seen & 0xff);
+        ok = false;
+    }
+    return ok;
+}
+
+/*
+ * ErrorRollOver in a report with a key array: the held keys stay down and
+ * only the modifier bits are taken from the report.  Run through the
+ * layout decoder with the boot layout, expected events written by hand.
+ */
+static bool check_rollover(const u16 *keymap)
+{
+    static const struct {
+        unsigned char rep[USB_KBD_BOOT_REPORT_LEN];
+        unsigned int nexp;
+        struct { u16 code; int value; } exp[4];
+    } steps[] = {
+        /* LeftShift + C; presses come in usage order */
+        {{0x02, 0, 0x06}, 2, {{KEY_C, 1}, {KEY_LEFTSHIFT, 1}}},
+        /* Phantom state while LeftCtrl goes down: C is still held */
+        {{0x03, 0, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01}, 1, {{KEY_LEFTCTRL, 1}}},
+        /* Phantom state again while LeftShift goes up */
+        {{0x01, 0, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01}, 1, {{KEY_LEFTSHIFT, 0}}},
+        /* Everything up */
+        {{0}, 2, {{KEY_C, 0}, {KEY_LEFTCTRL, 0}}},
+    };
+    struct usb_kbd_event events[USB_KBD_CORE_MAX_EVENTS];
+    struct usb_kbd_core core;
+    unsigned int s, i, n;
+    bool ok = true;
+
+    usb_kbd_core_init(&core);
+    for (s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+        n = usb_kbd_core_process_layout(&core, keymap, &boot_layout, steps[s].rep, USB_KBD_BOOT_REPORT_LEN,
+                                        events);
+        if (n != steps[s].nexp)
+            ok = false;
+        for (i = 0; i < n && i < steps[s].nexp; i++)
+            if (events[i].code != steps[s].exp[i].code || events[i].value != steps[s].exp[i].value)
+                ok = false;
+        if (!ok) {
+            fprintf(stderr, "rollover check: step %u gave %u events, expected %u\n", s, n, steps[s].nexp);
+            for (i = 0; i < n; i++)
+                fprintf(stderr, "  keycode %u value %d\n", events[i].code, events[i].value);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-N | -d desc.bin] [-f reports.bin] [-n count] [-r passes] [-s seed] [-b ms]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL, *desc_path = NULL;
+    const struct usb_kbd_layout *layout = NULL;
+    struct usb_kbd_layout parsed;
+    bool nkro = false;
+    size_t count = 1000000;
+    unsigned int passes = 10;
+    unsigned int seed = 0x1406;
+    struct usb_kbd_event events[USB_KBD_CORE_MAX_EVENTS];
+    struct usb_kbd_core core;
+    struct usb_kbd_debounce db;
+    unsigned int debounce = 0;
+    unsigned long long chatter = 0;
+    u16 keymap[USB_KBD_KEYMAP_SIZE];
+    unsigned long long best = ~0ULL, total = 0, t0, t1;
+    unsigned long long nevents = 0, unknown = 0, presses = 0;
+    unsigned long allocs_before, allocs;
+    unsigned char *reports;
+    unsigned int p;
+    size_t r;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:d:f:n:Nr:s:")) != -1) {
+        switch (opt) {
+        case 'b':
+            debounce = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            desc_path = optarg;
+            break;
+        case 'N':
+            nkro = true;
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            passes = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (!count || !passes || !seed || debounce > 255)
+        usage(argv[0]);
+
+    if (desc_path || nkro) {
+        size_t desc_len = sizeof(nkro_desc);
+        unsigned char *desc = desc_path ? load_file(desc_path, 1, &desc_len) : NULL;
+
+        if (desc_path && !desc)
+            return EXIT_FAILURE;
+        if (usb_kbd_parse_report_desc(desc ? desc : nkro_desc, desc_len, &parsed)) {
+            fprintf(stderr, "no decodable keyboard input report in descriptor\n");
+            return EXIT_FAILURE;
+        }
+        free(desc);
+        layout = &parsed;
+    }
+
+    if (path)
+        reports = load_file(path, layout ? layout->report_len : USB_KBD_BOOT_REPORT_LEN, &count);
+    else if (layout)
+        reports = make_synthetic(layout, count, 10, seed);
+    else
+        reports = make_synthetic(&boot_layout, count, USB_KBD_BOOT_KEYS, seed);
+    if (!reports || !count) {
+        fprintf(stderr, "no reports to replay\n");
+        return EXIT_FAILURE;
+    }
+
+    usb_kbd_core_default_keymap(keymap);
+    if (!check_modifiers(keymap) || !check_rollover(keymap)) {
+        free(reports);
+        return EXIT_FAILURE;
+    }
+    memset(&db, 0, sizeof(db));
+    memset(db.window_ms, debounce, sizeof(db.window_ms));
+
+    allocs_before = alloc_count;
+    for (p = 0; p < passes; p++) {
+        unsigned long long pass_events = 0;
+
+        usb_kbd_core_init(&core);
+        usb_kbd_debounce_reset(&db);
+        t0 = now_ns();
+        for (r = 0; r < count; r++) {
+            unsigned int i, n;
+
+            if (layout)
+                n = usb_kbd_core_process_layout(&core, keymap, layout, reports + r * layout->report_len,
+                                                layout->report_len, events);
+            else
+                n = usb_kbd_core_process(&core, keymap, reports + r * USB_KBD_BOOT_REPORT_LEN, events);
+            if (debounce)
+                n = usb_kbd_debounce_filter(&db, events, n, (r + 1) * 1000000ULL);
+
+            pass_events += n;
+            if (p == 0) {
+                for (i = 0; i < n; i++) {
+                    unknown += !events[i].code && events[i].value;
+                    presses += events[i].value;
+                }
+            }
+        }
+        t1 = now_ns();
+
+        if (t1 - t0 < best)
+            best = t1 - t0;
+        total += t1 - t0;
+        nevents = pass_events;
+    }
+    allocs = alloc_count - allocs_before;
+    for (r = 0; r < USB_KBD_KEYMAP_SIZE; r++)
+        chatter += db.chatter[r];
+
+    printf("source:        %s\n", path ? path : "synthetic");
+    if (layout)
+        printf("layout:        report id %u, %u bytes, %u bitfields, %u array keys\n",
+               layout->report_id, layout->report_len, layout->nbitfields, layout->array_count);
+    else
+        printf("layout:        boot protocol\n");
+    printf("reports:       %zu x %u passes\n", count, passes);
+    printf("events/pass:   %llu (%llu presses, %llu releases, %llu unmapped presses)\n",
+           nevents, presses, nevents - presses, unknown);
+    if (debounce)
+        printf("debounce:      %u ms, %llu presses swallowed/pass\n", debounce, chatter / passes);
+    printf("ns/report:     %.2f best, %.2f mean\n",
+           (double)best / count, (double)total / passes / count);
+    printf("allocations:   %lu during decode\n", allocs);
+
+    free(reports);
+    return allocs ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,38 +1,31 @@
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <fcntl.h>
-#include <unistd.h>
+#include <string.h>
 #include <linux/input.h>
 
-#define EVENT_DEV "/dev/input/event5" // Thay thế bằng số thiết bị sự kiện của bạn
-#define KEY_U 22 // Key code for 'U'
+#include "kbd_evdev.h"
 
 void print_message() {
     printf("Toi Yeu Driver\n");
 }
 
-int main() {
-    int fd = open(EVENT_DEV, O_RDWR);
-    if (fd == -1) {
-        perror("Cannot open device");
-        exit(EXIT_FAILURE);
-    }
-
-    struct input_event ev;
-
-    while (1) {
-        if (read(fd, &ev, sizeof(struct input_event)) == -1) {
-            perror("Failed to read device");
-            exit(EXIT_FAILURE);
-        }
-
-        if (ev.type == EV_KEY && ev.code == KEY_U && ev.value == 1) {
-            // U key pressed, print message
+// In thông điệp mỗi khi nhấn U
+static int on_frame(int fd, const struct input_event *ev, unsigned int n, void *arg) {
+    for (unsigned int i = 0; i < n; i++)
+        if (ev[i].type == EV_KEY && ev[i].code == KEY_U && ev[i].value == 1)
             print_message();
-        }
-    }
-
-    close(fd);
     return 0;
 }
 
+int main(int argc, char **argv) {
+    // Không có tham số: tự tìm bàn phím usbkbd qua sysfs
+    struct kbd_evdev *kd = kbd_evdev_open(argc > 1 ? argv[1] : NULL, O_RDONLY);
+    if (!kd)
+        exit(EXIT_FAILURE);
+
+    int ret = kbd_evdev_run(kd, on_frame, NULL);
+    kbd_evdev_close(kd);
+    fprintf(stderr, "Failed to read device: %s\n", strerror(-ret));
+    return EXIT_FAILURE;
+}
@@ -137,10 +137,10 @@ verify_environment() {
     fi
     
     # Check source files
-    if [ -f "usbkbd.c" ] && [ -f "Makefile" ]; then
+    if [ -f "usbkbd_main.c" ] && [ -f "usbkbd_core.c" ] && [ -f "Makefile" ]; then
         log_success "Source files present ✓"
     else
-        log_error "Missing source files (usbkbd.c or Makefile)"
+        log_error "Missing source files (usbkbd_main.c, usbkbd_core.c or Makefile)"
         exit 1
     fi
 }
@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Benchmark đọc evdev: vòng lặp một read() cho mỗi event của các tool cũ so
+# với bộ đọc theo lô kbd_evdev, cùng lúc trên cùng bàn phím ảo đang gõ.
+# Các phím của kịch bản được map sang F13-F24 để không gõ vào console.
+#
+#   sudo ./test_evdev.sh              10000 event, 1000 report/s
+#   sudo ./test_evdev.sh 100000 200   100000 event, 200 report/s
+
+EVENTS=${1:-10000}
+RATE=${2:-1000}
+DRIVER=/sys/bus/usb/drivers/usbkbd
+
+echo "=== usbkbd evdev reader benchmark ==="
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "ERROR: run as root"
+    exit 1
+fi
+
+make tools >/dev/null || exit 1
+[ -f usbkbd.ko ] || make || exit 1
+
+cleanup() {
+    [ -n "$GADGET_PID" ] && kill "$GADGET_PID" 2>/dev/null && wait "$GADGET_PID" 2>/dev/null
+    rmmod usbkbd 2>/dev/null
+    rmmod raw_gadget dummy_hcd 2>/dev/null
+}
+trap cleanup EXIT
+
+rmmod usbhid 2>/dev/null || true
+rmmod usbkbd raw_gadget dummy_hcd 2>/dev/null
+modprobe dummy_hcd || exit 1
+modprobe raw_gadget || exit 1
+insmod usbkbd.ko || exit 1
+
+# Gõ sau 3 s, đủ thời gian để đổi keymap
+./kbd_gadget -p -D 3 -n 0 -r $RATE &
+GADGET_PID=$!
+
+for i in $(seq 1 20); do
+    INTF=$(ls -d $DRIVER/*:* 2>/dev/null | head -1)
+    [ -n "$INTF" ] && break
+    sleep 0.1
+done
+if [ -z "$INTF" ]; then
+    echo "ERROR: usbkbd did not bind"
+    exit 1
+fi
+
+MAP="clear"
+for sc in $(seq 4 101); do
+    MAP="$MAP $sc:$((183 + sc % 12))"
+done
+echo "$MAP" > $INTF/keymap
+
+EVDEV=/dev/input/$(ls $INTF/input/*/ | grep -m1 event)
+echo "Keyboard: $(basename $INTF) -> $EVDEV"
+sleep 3
+
+./kbd_evbench -n $EVENTS $EVDEV
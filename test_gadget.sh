@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# Test tự động không cần người gõ phím: bàn phím ảo (dummy_hcd + raw-gadget)
+# phát chuỗi report theo kịch bản, kiểm tra luồng evdev và các SET_REPORT LED
+# mà driver gửi về, in throughput và độ trễ p50/p90/p99.
+#
+#   sudo ./test_gadget.sh             full speed 1 kHz, high speed 8 kHz, rồi
+#                                     8 kHz nhờ poll_interval_us
+#   sudo ./test_gadget.sh 50000       số report mỗi lần chạy
+
+COUNT=${1:-10000}
+FAILED=0
+
+echo "=== usbkbd virtual keyboard test ==="
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "ERROR: run as root"
+    exit 1
+fi
+
+make tools >/dev/null || exit 1
+[ -f usbkbd.ko ] || make || exit 1
+
+cleanup() {
+    rmmod usbkbd 2>/dev/null
+    rmmod raw_gadget dummy_hcd 2>/dev/null
+}
+trap cleanup EXIT
+
+rmmod usbhid 2>/dev/null || true
+rmmod usbkbd raw_gadget dummy_hcd 2>/dev/null
+modprobe dummy_hcd || exit 1
+modprobe raw_gadget || exit 1
+insmod usbkbd.ko || exit 1
+
+run() {
+    echo ""
+    echo "--- $* ---"
+    if ./kbd_gadget -t -n $COUNT "$@"; then
+        echo "✓ PASS"
+    else
+        echo "✗ FAIL"
+        FAILED=1
+    fi
+    sleep 1
+}
+
+run -S full -i 1 -r 1000
+run -S high -i 1 -r 8000
+
+# Descriptor nói 1 ms (bInterval 4), driver ghi đè thành 125 µs
+echo 125 > /sys/module/usbkbd/parameters/poll_interval_us
+run -S high -i 4 -r 8000
+echo 0 > /sys/module/usbkbd/parameters/poll_interval_us
+
+echo ""
+dmesg | grep -i usbkbd | tail -5
+exit $FAILED
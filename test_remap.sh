@@ -0,0 +1,65 @@
+#!/bin/bash
+
+# Self-test độ trễ của kbd_remap: mỗi frame từ bàn phím ảo đang gõ đi qua
+# bộ remap userspace và uinput; in thời gian từ timestamp của driver tới
+# lúc write() và tới lúc client của thiết bị uinput nhận được.
+# Các phím của kịch bản được map sang F13-F24 để không gõ vào console.
+#
+#   sudo ./test_remap.sh                10000 frame, 200 report/s
+#   sudo ./test_remap.sh 10000 1000 50  1000 report/s, remap chạy SCHED_FIFO 50
+
+FRAMES=${1:-10000}
+RATE=${2:-200}
+PRIO=${3:+-P $3}
+DRIVER=/sys/bus/usb/drivers/usbkbd
+
+echo "=== usbkbd userspace remap latency ==="
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "ERROR: run as root"
+    exit 1
+fi
+
+make tools >/dev/null || exit 1
+[ -f usbkbd.ko ] || make || exit 1
+
+cleanup() {
+    [ -n "$GADGET_PID" ] && kill "$GADGET_PID" 2>/dev/null && wait "$GADGET_PID" 2>/dev/null
+    rmmod usbkbd 2>/dev/null
+    rmmod raw_gadget dummy_hcd 2>/dev/null
+}
+trap cleanup EXIT
+
+rmmod usbhid 2>/dev/null || true
+rmmod usbkbd raw_gadget dummy_hcd 2>/dev/null
+modprobe dummy_hcd || exit 1
+modprobe raw_gadget || exit 1
+modprobe uinput || exit 1
+insmod usbkbd.ko || exit 1
+
+# Gõ sau 3 s, đủ thời gian để đổi keymap
+./kbd_gadget -p -D 3 -n 0 -r $RATE &
+GADGET_PID=$!
+
+for i in $(seq 1 20); do
+    INTF=$(ls -d $DRIVER/*:* 2>/dev/null | head -1)
+    [ -n "$INTF" ] && break
+    sleep 0.1
+done
+if [ -z "$INTF" ]; then
+    echo "ERROR: usbkbd did not bind"
+    exit 1
+fi
+
+MAP="clear"
+for sc in $(seq 4 101); do
+    MAP="$MAP $sc:$((183 + sc % 12))"
+done
+echo "$MAP" > $INTF/keymap
+
+EVDEV=/dev/input/$(ls $INTF/input/*/ | grep -m1 event)
+echo "Keyboard: $(basename $INTF) -> $EVDEV"
+sleep 3
+
+# F13 <-> F14, F15 bỏ đi; các phím khác đi qua nguyên vẹn
+./kbd_remap -d $EVDEV -t $FRAMES $PRIO 183:184 184:183 185:0
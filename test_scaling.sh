@@ -0,0 +1,102 @@
+#!/bin/bash
+
+# Scaling test: gắn nhiều bàn phím ảo (dummy_hcd + raw-gadget) rồi nạp usbkbd,
+# đo bộ nhớ mỗi thiết bị và thời gian probe.
+#
+#   sudo ./test_scaling.sh            64 bàn phím: 32 gadget x 2 interface
+#   sudo ./test_scaling.sh 16 4       16 gadget x 4 interface
+
+GADGETS=${1:-32}
+PER_GADGET=${2:-2}
+KEYBOARDS=$((GADGETS * PER_GADGET))
+TRACING=/sys/kernel/tracing
+DRIVER=/sys/bus/usb/drivers/usbkbd
+
+echo "=== usbkbd scaling test: $KEYBOARDS keyboards ==="
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "ERROR: run as root"
+    exit 1
+fi
+
+make tools >/dev/null || exit 1
+[ -f usbkbd.ko ] || make || exit 1
+
+cleanup() {
+    [ -n "$GADGET_PID" ] && kill "$GADGET_PID" 2>/dev/null && wait "$GADGET_PID" 2>/dev/null
+    echo nop > $TRACING/current_tracer 2>/dev/null
+    echo > $TRACING/set_graph_function 2>/dev/null
+    rmmod usbkbd 2>/dev/null
+    rmmod raw_gadget dummy_hcd 2>/dev/null
+}
+trap cleanup EXIT
+
+# 1. Gắn các bàn phím ảo khi chưa có driver nào nhận chúng
+rmmod usbkbd 2>/dev/null
+rmmod usbhid 2>/dev/null || true
+rmmod raw_gadget dummy_hcd 2>/dev/null
+modprobe dummy_hcd num=$GADGETS || exit 1
+modprobe raw_gadget || exit 1
+
+./kbd_gadget -g $GADGETS -k $PER_GADGET &
+GADGET_PID=$!
+
+echo "1. Waiting for $KEYBOARDS interfaces to enumerate..."
+for i in $(seq 1 100); do
+    n=$(grep -l "^03$" /sys/bus/usb/devices/*:*/bInterfaceClass 2>/dev/null | wc -l)
+    [ "$n" -ge "$KEYBOARDS" ] && break
+    sleep 0.1
+done
+sleep 1
+
+# 2. Nạp driver, đo thời gian probe bằng function_graph
+if [ -d $TRACING ]; then
+    echo > $TRACING/trace
+    echo usb_kbd_probe > $TRACING/set_graph_function 2>/dev/null &&
+        echo function_graph > $TRACING/current_tracer
+fi
+
+slab_before=$(awk '/^Slab:/ {print $2}' /proc/meminfo)
+percpu_before=$(awk '/^Percpu:/ {print $2}' /proc/meminfo)
+t0=$(date +%s%N)
+
+echo "2. Loading usbkbd..."
+insmod usbkbd.ko || exit 1
+for i in $(seq 1 100); do
+    bound=$(ls -d $DRIVER/*:* 2>/dev/null | wc -l)
+    [ "$bound" -ge "$KEYBOARDS" ] && break
+    sleep 0.05
+done
+t1=$(date +%s%N)
+sleep 1
+
+slab_after=$(awk '/^Slab:/ {print $2}' /proc/meminfo)
+percpu_after=$(awk '/^Percpu:/ {print $2}' /proc/meminfo)
+
+# 3. Kết quả
+echo ""
+echo "=== RESULTS ==="
+echo "Keyboards bound:       $bound / $KEYBOARDS"
+echo "Time to bind all:      $(((t1 - t0) / 1000000)) ms"
+if [ "$bound" -gt 0 ]; then
+    echo "Slab per keyboard:     $(((slab_after - slab_before) / bound)) kB"
+    echo "Percpu per keyboard:   $(((percpu_after - percpu_before) / bound)) kB"
+fi
+
+if [ -f $TRACING/trace ]; then
+    grep "usb_kbd_probe" $TRACING/trace |
+        grep -o "[0-9.]\+ us" |
+        awk '{ s += $1; if ($1 > m) m = $1; n++ }
+             END { if (n) printf "usb_kbd_probe:         %d calls, mean %.1f us, max %.1f us\n", n, s / n, m }'
+fi
+
+# Mỗi interface phải có input device riêng: tên của driver, VID:PID của
+# kbd_gadget và phys nằm trên dummy_hcd
+inputs=$(awk -v RS= '/Vendor=1d6b Product=0104/ && /Name="USB HIDBP Keyboard"/ &&
+                     /Phys=usb-dummy_hcd/ { n++ } END { print n + 0 }' /proc/bus/input/devices)
+echo "Input devices:         $inputs / $KEYBOARDS"
+
+if [ "$inputs" -ne "$KEYBOARDS" ]; then
+    echo "FAIL: expected one input device per keyboard interface"
+    exit 1
+fi
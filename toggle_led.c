@@ -1,50 +1,54 @@
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 #include <linux/input.h>
 
-#define EVENT_DEV "/dev/input/event5" // Thay thế bằng số thiết bị sự kiện của bạn
-#define KEY_D 32 // Key code for 'D'
+#include "kbd_evdev.h"
 
-void send_led_event(int fd, int led_code, int led_state) {
-    struct input_event ev;
+static int send_led_event(int fd, int led_code, int led_state) {
+    struct input_event ev[2];
 
-    ev.type = EV_LED;
-    ev.code = led_code;
-    ev.value = led_state;
+    memset(ev, 0, sizeof(ev));
+    ev[0].type = EV_LED;
+    ev[0].code = led_code;
+    ev[0].value = led_state;
+    ev[1].type = EV_SYN;
+    ev[1].code = SYN_REPORT;
 
-    if (write(fd, &ev, sizeof(struct input_event)) == -1) {
+    // Một lần write() cho cả LED và SYN_REPORT
+    if (write(fd, ev, sizeof(ev)) == -1) {
         perror("Failed to write LED event");
-        exit(EXIT_FAILURE);
+        return -1;
     }
+    return 0;
 }
 
-int main() {
-    int fd = open(EVENT_DEV, O_RDWR);
-    if (fd == -1) {
-        perror("Cannot open device");
-        exit(EXIT_FAILURE);
-    }
-
-    struct input_event ev;
-
-    while (1) {
-        if (read(fd, &ev, sizeof(struct input_event)) == -1) {
-            perror("Failed to read device");
-            exit(EXIT_FAILURE);
-        }
-
-        if (ev.type == EV_KEY && ev.code == KEY_D && ev.value == 1) {
-            // D key pressed, toggle LED state (example with NUMLOCK LED)
+// Nhấn D: bật/tắt LED NUMLOCK trên đúng bàn phím vừa gõ
+static int on_frame(int fd, const struct input_event *ev, unsigned int n, void *arg) {
+    for (unsigned int i = 0; i < n; i++) {
+        if (ev[i].type == EV_KEY && ev[i].code == KEY_D && ev[i].value == 1) {
             printf("Toggling NUMLOCK LED...\n");
-            send_led_event(fd, LED_NUML, 1); // Turn NUMLOCK LED on
+            if (send_led_event(fd, LED_NUML, 1)) // Turn NUMLOCK LED on
+                return 1;
             sleep(1); // Wait for a moment
-            send_led_event(fd, LED_NUML, 0); // Turn NUMLOCK LED off
+            if (send_led_event(fd, LED_NUML, 0)) // Turn NUMLOCK LED off
+                return 1;
         }
     }
-
-    close(fd);
     return 0;
 }
 
+int main(int argc, char **argv) {
+    // Không có tham số: tự tìm bàn phím usbkbd qua sysfs
+    struct kbd_evdev *kd = kbd_evdev_open(argc > 1 ? argv[1] : NULL, O_RDWR);
+    if (!kd)
+        exit(EXIT_FAILURE);
+
+    int ret = kbd_evdev_run(kd, on_frame, NULL);
+    kbd_evdev_close(kd);
+    if (ret < 0)
+        fprintf(stderr, "Failed to read device: %s\n", strerror(-ret));
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,48 @@
+/*
+ * Raw report capture ring shared between usbkbd and userspace.
+ *
+ * When capture is enabled (sysfs "capture"), the completion handler
+ * copies every interrupt URB it gets, with its completion time, into a
+ * single-producer/single-consumer ring.  Userspace maps the ring through
+ * debugfs (usbkbd/<interface>/capture) and consumes it without a syscall
+ * per record; kbd_capture is the reference reader.
+ *
+ * Layout of the mapping: one page holding struct usb_kbd_capture_header,
+ * then nr_records records of record_size bytes.  The kernel only writes
+ * head and dropped, the reader only writes tail.  A full ring drops new
+ * records rather than overwriting ones the reader has not seen.
+ */
+#ifndef USBKBD_CAPTURE_H
+#define USBKBD_CAPTURE_H
+
+#include "usbkbd_core.h"
+
+#define USB_KBD_CAPTURE_MAGIC 0x55424b43 /* "CKBU" */
+#define USB_KBD_CAPTURE_VERSION 1
+#define USB_KBD_CAPTURE_DATA 48
+
+struct usb_kbd_capture_header
+{
+    u32 magic;
+    u32 version;
+    u32 nr_records;     /* power of two */
+    u32 record_size;
+    u32 records_offset; /* from the start of the mapping */
+    u32 report_len;     /* decoded report length: 8 in boot protocol */
+    u8 report_mode;     /* 1 if reports follow the device's report descriptor */
+    u8 pad[7];
+    u64 head;           /* records produced; kernel writes, release order */
+    u64 dropped;        /* records lost to a full ring */
+    u64 tail __attribute__((aligned(64))); /* records consumed; reader writes */
+};
+
+struct usb_kbd_capture_record
+{
+    u64 ns;       /* CLOCK_MONOTONIC at URB completion */
+    s32 status;   /* urb->status */
+    u16 len;      /* urb->actual_length, data holds the first USB_KBD_CAPTURE_DATA bytes */
+    u16 pad;
+    u8 data[USB_KBD_CAPTURE_DATA];
+};
+
+#endif /* USBKBD_CAPTURE_H */
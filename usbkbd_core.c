@@ -0,0 +1,792 @@
+#include "usbkbd_core.h"
+
+#ifdef __KERNEL__
+#include <linux/input.h>
+#else
+#include <linux/input-event-codes.h>
+#endif
+
+const unsigned char usb_kbd_keycode[256] = {
+    0, 0, 0, 0, 30, 48, 46, 32, 18, 33, 34, 35, 23, 36, 37, 38,
+    50, 49, 24, 25, 16, 19, 31, 20, 22, 47, 17, 45, 21, 44, 2, 3,
+    4, 5, 6, 7, 8, 9, 10, 11, 28, 1, 14, 15, 57, 12, 13, 26,
+    27, 43, 43, 39, 40, 41, 51, 52, 53, 58, 59, 60, 61, 62, 63, 64,
+    65, 66, 67, 68, 87, 88, 99, 70, 119, 110, 102, 104, 111, 107, 109, 106,
+    105, 108, 103, 69, 98, 55, 74, 78, 96, 79, 80, 81, 75, 76, 77, 71,
+    72, 73, 82, 83, 86, 127, 116, 117, 183, 184, 185, 186, 187, 188, 189, 190,
+    191, 192, 193, 194, 134, 138, 130, 132, 128, 129, 131, 137, 133, 135, 136, 113,
+    115, 114, 0, 0, 0, 121, 0, 89, 93, 124, 92, 94, 95, 0, 0, 0,
+    122, 123, 90, 91, 85, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    29, 42, 56, 125, 97, 54, 100, 126, 164, 166, 165, 163, 161, 115, 114, 113,
+    150, 158, 159, 128, 136, 177, 178, 176, 142, 152, 173, 140};
+
+/*
+ * Consumer-page and system-control usages with a key, sorted by extended
+ * usage (page << 16 | id).  Their index is the dense number the consumer
+ * decoder works with.
+ */
+const struct usb_kbd_consumer_usage usb_kbd_consumer_usages[] = {
+    {0x00010081, KEY_POWER},          /* System Power Down */
+    {0x00010082, KEY_SLEEP},          /* System Sleep */
+    {0x00010083, KEY_WAKEUP},         /* System Wake Up */
+    {0x000c0030, KEY_POWER},
+    {0x000c0032, KEY_SLEEP},
+    {0x000c006f, KEY_BRIGHTNESSUP},
+    {0x000c0070, KEY_BRIGHTNESSDOWN},
+    {0x000c00b0, KEY_PLAY},
+    {0x000c00b1, KEY_PAUSE},
+    {0x000c00b2, KEY_RECORD},
+    {0x000c00b3, KEY_FASTFORWARD},
+    {0x000c00b4, KEY_REWIND},
+    {0x000c00b5, KEY_NEXTSONG},
+    {0x000c00b6, KEY_PREVIOUSSONG},
+    {0x000c00b7, KEY_STOPCD},
+    {0x000c00b8, KEY_EJECTCD},
+    {0x000c00cd, KEY_PLAYPAUSE},
+    {0x000c00e2, KEY_MUTE},
+    {0x000c00e9, KEY_VOLUMEUP},
+    {0x000c00ea, KEY_VOLUMEDOWN},
+    {0x000c0183, KEY_CONFIG},         /* media player */
+    {0x000c018a, KEY_MAIL},
+    {0x000c0192, KEY_CALC},
+    {0x000c0194, KEY_FILE},           /* local browser */
+    {0x000c0196, KEY_WWW},
+    {0x000c019e, KEY_COFFEE},         /* terminal lock */
+    {0x000c01a7, KEY_DOCUMENTS},
+    {0x000c0221, KEY_SEARCH},
+    {0x000c0223, KEY_HOMEPAGE},
+    {0x000c0224, KEY_BACK},
+    {0x000c0225, KEY_FORWARD},
+    {0x000c0226, KEY_STOP},
+    {0x000c0227, KEY_REFRESH},
+    {0x000c022a, KEY_BOOKMARKS},
+};
+const unsigned int usb_kbd_consumer_nusages = sizeof(usb_kbd_consumer_usages) / sizeof(usb_kbd_consumer_usages[0]);
+_Static_assert(sizeof(usb_kbd_consumer_usages) / sizeof(usb_kbd_consumer_usages[0]) < USB_KBD_CONSUMER_NONE &&
+               sizeof(usb_kbd_consumer_usages) / sizeof(usb_kbd_consumer_usages[0]) <= 64,
+               "dense consumer numbers must fit a u64");
+
+void usb_kbd_core_init(struct usb_kbd_core *core)
+{
+    memset(core, 0, sizeof(*core));
+}
+
+void usb_kbd_core_default_keymap(u16 *keymap)
+{
+    int i;
+
+    for (i = 0; i < USB_KBD_KEYMAP_SIZE; i++)
+        keymap[i] = usb_kbd_keycode[i];
+
+    /* The driver's signature feature: A and B are swapped */
+    keymap[0x04] = KEY_B;
+    keymap[0x05] = KEY_A;
+}
+
+static unsigned int usb_kbd_core_release(struct usb_kbd_core *core, u64 bits,
+                                         unsigned int base, struct usb_kbd_event *ev)
+{
+    unsigned int n = 0;
+
+    while (bits)
+    {
+        unsigned int sc = base + usb_kbd_ctz64(bits);
+
+        bits &= bits - 1;
+        ev[n].code = core->active[sc];
+        ev[n].scancode = sc;
+        ev[n].value = 0;
+        n++;
+    }
+    return n;
+}
+
+static unsigned int usb_kbd_core_press(struct usb_kbd_core *core, const u16 *keymap,
+                                       u64 bits, unsigned int base, struct usb_kbd_event *ev)
+{
+    unsigned int n = 0;
+
+    while (bits)
+    {
+        unsigned int sc = base + usb_kbd_ctz64(bits);
+
+        bits &= bits - 1;
+        ev[n].code = core->active[sc] = keymap[sc];
+        ev[n].scancode = sc;
+        ev[n].value = 1;
+        n++;
+    }
+    return n;
+}
+
+/* Emit the difference between @state and the previous report, then adopt it */
+static unsigned int usb_kbd_core_diff(struct usb_kbd_core *core, const u16 *keymap,
+                                      const u64 *state, struct usb_kbd_event *events)
+{
+    unsigned int n = 0;
+    int i;
+
+    for (i = 0; i < USB_KBD_STATE_WORDS; i++)
+        n += usb_kbd_core_release(core, core->pressed[i] & ~state[i], i * 64, events + n);
+    for (i = 0; i < USB_KBD_STATE_WORDS; i++)
+        n += usb_kbd_core_press(core, keymap, state[i] & ~core->pressed[i], i * 64, events + n);
+
+    memcpy(core->pressed, state, sizeof(core->pressed));
+    return n;
+}
+
+unsigned int usb_kbd_core_process(struct usb_kbd_core *core, const u16 *keymap,
+                                  const u8 *report, struct usb_kbd_event *events)
+{
+    u64 state[USB_KBD_STATE_WORDS] = {0};
+    int i;
+
+    if (report[2] == 0x01)
+    {
+        /* ErrorRollOver: keep the held keys, only the modifier byte is valid */
+        memcpy(state, core->pressed, sizeof(state));
+        state[USB_KBD_MOD_USAGE / 64] &= ~(0xffULL << (USB_KBD_MOD_USAGE % 64));
+    }
+    else
+    {
+        /* Usages 0..3 are "no event" and error codes, masked off below */
+        for (i = 2; i < USB_KBD_BOOT_REPORT_LEN; i++)
+            state[report[i] >> 6] |= 1ULL << (report[i] & 63);
+        state[0] &= ~0xfULL;
+    }
+    state[USB_KBD_MOD_USAGE / 64] |= (u64)report[0] << (USB_KBD_MOD_USAGE % 64);
+
+    return usb_kbd_core_diff(core, keymap, state, events);
+}
+
+/* OR a run of 1-bit report fields into the usage bitmap, up to 8 bits at a time */
+static void usb_kbd_core_copy_bits(u64 *state, const u8 *report,
+                                   const struct usb_kbd_bitfield *bf)
+{
+    unsigned int bit = bf->bit_offset;
+    unsigned int usage = bf->first_usage;
+    unsigned int left = bf->count;
+
+    while (left)
+    {
+        unsigned int n = left < 8 ? left : 8;
+        unsigned int shift = bit & 7;
+        unsigned int v = report[bit >> 3] >> shift;
+
+        if (shift + n > 8)
+            v |= report[(bit >> 3) + 1] << (8 - shift);
+        v &= (1u << n) - 1;
+
+        state[usage >> 6] |= (u64)v << (usage & 63);
+        if ((usage & 63) + n > 64)
+            state[(usage >> 6) + 1] |= (u64)v >> (64 - (usage & 63));
+
+        bit += n;
+        usage += n;
+        left -= n;
+    }
+}
+
+unsigned int usb_kbd_core_process_layout(struct usb_kbd_core *core, const u16 *keymap,
+                                         const struct usb_kbd_layout *layout,
+                                         const u8 *report, unsigned int len,
+                                         struct usb_kbd_event *events)
+{
+    const u64 mods_mask = 0xffULL << (USB_KBD_MOD_USAGE % 64);
+    u64 state[USB_KBD_STATE_WORDS] = {0};
+    u64 mods;
+    int i;
+
+    if (len < layout->report_len)
+        return 0;
+    if (layout->report_id && report[0] != layout->report_id)
+        return 0;
+
+    for (i = 0; i < layout->nbitfields; i++)
+        usb_kbd_core_copy_bits(state, report, &layout->bitfields[i]);
+
+    if (layout->array_count)
+    {
+        const u8 *arr = report + layout->array_offset / 8;
+
+        if (arr[0] == 0x01)
+        {
+            /* ErrorRollOver: keep the held keys, only the modifier bits are valid */
+            mods = state[USB_KBD_MOD_USAGE / 64] & mods_mask;
+            memcpy(state, core->pressed, sizeof(state));
+            state[USB_KBD_MOD_USAGE / 64] = (state[USB_KBD_MOD_USAGE / 64] & ~mods_mask) | mods;
+            return usb_kbd_core_diff(core, keymap, state, events);
+        }
+
+        for (i = 0; i < layout->array_count; i++)
+        {
+            unsigned int usage = arr[i] + layout->array_base;
+
+            if (usage < 256)
+                state[usage >> 6] |= 1ULL << (usage & 63);
+        }
+    }
+    state[0] &= ~0xfULL;
+
+    return usb_kbd_core_diff(core, keymap, state, events);
+}
+
+void usb_kbd_debounce_reset(struct usb_kbd_debounce *db)
+{
+    memset(db->released, 0, sizeof(db->released));
+    memset(db->swallowed, 0, sizeof(db->swallowed));
+}
+
+unsigned int usb_kbd_debounce_filter(struct usb_kbd_debounce *db, struct usb_kbd_event *events,
+                                     unsigned int n, u64 now)
+{
+    unsigned int i, kept = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        unsigned int sc = events[i].scancode;
+        u64 *swallowed = &db->swallowed[sc / 64];
+        u64 bit = 1ULL << (sc % 64);
+
+        if (!events[i].value)
+        {
+            /* A bouncing key keeps pushing its window out */
+            db->released[sc] = now;
+            if (*swallowed & bit)
+            {
+                *swallowed &= ~bit;
+                continue;
+            }
+        }
+        else if (db->window_ms[sc] && db->released[sc] &&
+                 now - db->released[sc] < db->window_ms[sc] * 1000000ULL)
+        {
+            *swallowed |= bit;
+            db->chatter[sc]++;
+            continue;
+        }
+        events[kept++] = events[i];
+    }
+    return kept;
+}
+
+void usb_kbd_led_policy_clear(struct usb_kbd_led_policy *policy)
+{
+    int mode;
+
+    for (mode = 0; mode < USB_KBD_LED_MODES; mode++)
+        usb_kbd_led_policy_set(policy, mode, -1, 0, 0, -1, 0, mode);
+}
+
+void usb_kbd_led_policy_default(struct usb_kbd_led_policy *policy)
+{
+    usb_kbd_led_policy_clear(policy);
+    usb_kbd_led_policy_set(policy, 0, LED_NUML, 0, USB_KBD_LED_CAPS_BIT, -1, USB_KBD_LED_CAPS_BIT, 1);
+    usb_kbd_led_policy_set(policy, 1, -1, 0, 0, -1, USB_KBD_LED_CAPS_BIT, 1);
+    usb_kbd_led_policy_set(policy, 1, LED_NUML, 0, 0, -1, 0, 0);
+}
+
+void usb_kbd_led_policy_set(struct usb_kbd_led_policy *policy, int mode, int code, u8 match, u8 mask,
+                            int out, u8 or_bits, int next)
+{
+    unsigned int m, c, s;
+
+    for (m = 0; m < USB_KBD_LED_MODES; m++)
+    {
+        if (mode >= 0 && m != (unsigned int)mode)
+            continue;
+        for (c = 0; c < USB_KBD_LED_CODES; c++)
+        {
+            if (code >= 0 && c != (unsigned int)code)
+                continue;
+            for (s = 0; s < USB_KBD_LED_STATES; s++)
+            {
+                struct usb_kbd_led_entry *e = &policy->entry[m][c][s];
+
+                if ((s & mask) != match)
+                    continue;
+                e->out = out < 0 ? s | or_bits : out;
+                if (next >= 0)
+                    e->next = next;
+            }
+        }
+    }
+}
+
+u64 usb_kbd_hist_percentile(const struct usb_kbd_hist *h, unsigned int pct)
+{
+    u64 seen = 0;
+    int i;
+
+    if (!h->count)
+        return 0;
+
+    /* First bucket where seen / count >= pct / 100, without a 64-bit division */
+    for (i = 0; i < USB_KBD_HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen * 100 >= h->count * pct)
+            return i == USB_KBD_HIST_BUCKETS - 1 ? h->max : 2ULL << i;
+    }
+    return h->max;
+}
+
+/* Value of the @size-bit field (at most 16) at bit @bit of @report */
+static unsigned int usb_kbd_get_field(const u8 *report, unsigned int bit, unsigned int size)
+{
+    unsigned int shift = bit & 7, i;
+    u32 v = 0;
+
+    for (i = 0; i < shift + size; i += 8)
+        v |= (u32)report[(bit >> 3) + i / 8] << i;
+    return (v >> shift) & ((1u << size) - 1);
+}
+
+unsigned int usb_kbd_consumer_process(u64 *pressed, const struct usb_kbd_consumer_layout *layout,
+                                      const u8 *report, unsigned int len, struct usb_kbd_event *events)
+{
+    u64 state = 0, clear = 0, bits;
+    unsigned int i, j, n = 0;
+
+    for (i = 0; i < layout->nfields; i++)
+    {
+        const struct usb_kbd_consumer_field *f = &layout->fields[i];
+
+        if (f->report_id && (!len || report[0] != f->report_id))
+            continue;
+        if (f->bit_offset + f->count * f->size > len * 8)
+            continue;
+
+        /* The report carries the whole state of the keys this field can name */
+        clear |= f->mask;
+        for (j = 0; j < f->count; j++)
+        {
+            unsigned int v = usb_kbd_get_field(report, f->bit_offset + j * f->size, f->size);
+            u8 d = USB_KBD_CONSUMER_NONE;
+
+            if (f->variable)
+                d = v ? layout->dense[f->map + j] : USB_KBD_CONSUMER_NONE;
+            else if ((s32)v >= f->logical_min && v - f->logical_min < f->nvalues)
+                d = layout->dense[f->map + v - f->logical_min];
+            if (d != USB_KBD_CONSUMER_NONE)
+                state |= 1ULL << d;
+        }
+    }
+    state |= *pressed & ~clear;
+
+    for (bits = *pressed & ~state; bits; bits &= bits - 1, n++)
+    {
+        events[n].scancode = usb_kbd_ctz64(bits);
+        events[n].code = usb_kbd_consumer_usages[events[n].scancode].keycode;
+        events[n].value = 0;
+    }
+    for (bits = state & ~*pressed; bits; bits &= bits - 1, n++)
+    {
+        events[n].scancode = usb_kbd_ctz64(bits);
+        events[n].code = usb_kbd_consumer_usages[events[n].scancode].keycode;
+        events[n].value = 1;
+    }
+
+    *pressed = state;
+    return n;
+}
+
+/*
+ * HID report descriptor items (HID 1.11, 6.2.2).  Only short items are
+ * interpreted; long items are skipped.  The tag values include the item
+ * type bits, i.e. they are the prefix byte with the size bits cleared.
+ */
+#define USB_KBD_ITEM_INPUT 0x80
+#define USB_KBD_ITEM_OUTPUT 0x90
+#define USB_KBD_ITEM_FEATURE 0xb0
+#define USB_KBD_ITEM_COLLECTION 0xa0
+#define USB_KBD_ITEM_END_COLLECTION 0xc0
+#define USB_KBD_ITEM_USAGE_PAGE 0x04
+#define USB_KBD_ITEM_LOGICAL_MIN 0x14
+#define USB_KBD_ITEM_LOGICAL_MAX 0x24
+#define USB_KBD_ITEM_REPORT_SIZE 0x74
+#define USB_KBD_ITEM_REPORT_ID 0x84
+#define USB_KBD_ITEM_REPORT_COUNT 0x94
+#define USB_KBD_ITEM_PUSH 0xa4
+#define USB_KBD_ITEM_POP 0xb4
+#define USB_KBD_ITEM_USAGE 0x08
+#define USB_KBD_ITEM_USAGE_MIN 0x18
+#define USB_KBD_ITEM_USAGE_MAX 0x28
+#define USB_KBD_ITEM_LONG 0xfe
+
+#define USB_KBD_PAGE_GENERIC_DESKTOP 0x01
+#define USB_KBD_PAGE_KEYBOARD 0x07
+#define USB_KBD_PAGE_CONSUMER 0x0c
+#define USB_KBD_INPUT_CONSTANT 0x01
+#define USB_KBD_INPUT_VARIABLE 0x02
+
+#define USB_KBD_PARSE_STACK 4
+#define USB_KBD_PARSE_IDS 8
+#define USB_KBD_PARSE_USAGES 32
+
+struct usb_kbd_globals
+{
+    u32 usage_page;
+    s32 logical_min;
+    s32 logical_max;
+    u32 report_size;
+    u32 report_count;
+    u8 report_id;
+};
+
+struct usb_kbd_parser
+{
+    struct usb_kbd_globals g;
+    struct usb_kbd_globals stack[USB_KBD_PARSE_STACK];
+    unsigned int depth;
+    u32 usage;      /* first Usage item, extended (page << 16 | id) */
+    u32 usage_min;
+    u32 usage_max;
+    bool have_usage;
+    bool have_min;
+    bool have_max;
+    /* every Usage item of the main item, extended; the rest are dropped */
+    u32 usages[USB_KBD_PARSE_USAGES];
+    unsigned int nusages;
+    /* bit offsets per report ID seen so far */
+    u8 ids[USB_KBD_PARSE_IDS];
+    u32 offsets[USB_KBD_PARSE_IDS];
+    unsigned int nids;
+};
+
+static u32 *usb_kbd_parser_offset(struct usb_kbd_parser *p)
+{
+    unsigned int i;
+
+    for (i = 0; i < p->nids; i++)
+        if (p->ids[i] == p->g.report_id)
+            return &p->offsets[i];
+    if (p->nids == USB_KBD_PARSE_IDS)
+        return NULL;
+
+    p->ids[p->nids] = p->g.report_id;
+    p->offsets[p->nids] = p->g.report_id ? 8 : 0;
+    return &p->offsets[p->nids++];
+}
+
+/* Usage page of the current main item: its first Usage if extended, else the global one */
+static u32 usb_kbd_parser_page(const struct usb_kbd_parser *p)
+{
+    if (p->have_usage && (p->usage >> 16))
+        return p->usage >> 16;
+    return p->g.usage_page;
+}
+
+struct usb_kbd_keyboard_parse
+{
+    struct usb_kbd_layout *layout;
+    bool chosen;
+};
+
+/* Input item callback for usb_kbd_parse_report_desc(), @offset in bits */
+static int usb_kbd_parser_input(const struct usb_kbd_parser *p, u32 flags, u32 offset, void *ctx)
+{
+    struct usb_kbd_keyboard_parse *kp = ctx;
+    struct usb_kbd_layout *layout = kp->layout;
+    bool *chosen = &kp->chosen;
+    u32 page = usb_kbd_parser_page(p);
+    u32 first = p->have_min ? p->usage_min : (p->usage & 0xffff);
+
+    if (!(flags & USB_KBD_INPUT_CONSTANT) && page == USB_KBD_PAGE_KEYBOARD &&
+        (!*chosen || layout->report_id == p->g.report_id))
+    {
+        if ((flags & USB_KBD_INPUT_VARIABLE) && p->g.report_size == 1)
+        {
+            struct usb_kbd_bitfield *bf;
+
+            if (layout->nbitfields == USB_KBD_MAX_BITFIELDS ||
+                first + p->g.report_count > 256)
+                return -EINVAL;
+
+            bf = &layout->bitfields[layout->nbitfields++];
+            bf->bit_offset = offset;
+            bf->first_usage = first;
+            bf->count = p->g.report_count;
+        }
+        else if (!(flags & USB_KBD_INPUT_VARIABLE) && p->g.report_size == 8)
+        {
+            if (layout->array_count || (offset & 7) ||
+                p->g.report_count > USB_KBD_MAX_ARRAY_KEYS ||
+                (s32)first < p->g.logical_min || first - p->g.logical_min > 255)
+                return -EINVAL;
+
+            layout->array_offset = offset;
+            layout->array_count = p->g.report_count;
+            layout->array_base = first - p->g.logical_min;
+        }
+        else
+        {
+            return -EINVAL;
+        }
+
+        layout->report_id = p->g.report_id;
+        *chosen = true;
+    }
+    return 0;
+}
+
+/* Every main item ends the scope of the local items before it */
+static void usb_kbd_parser_end_locals(struct usb_kbd_parser *p)
+{
+    p->have_usage = false;
+    p->have_min = false;
+    p->have_max = false;
+    p->nusages = 0;
+}
+
+/* Sign-extend a short item's data of @size bytes */
+static s32 usb_kbd_item_signed(u32 data, unsigned int size)
+{
+    if (size && size < 4 && (data & (1u << (8 * size - 1))))
+        data |= ~0u << (8 * size);
+    return (s32)data;
+}
+
+/*
+ * Walk the items of a report descriptor, tracking globals, locals and
+ * the bit offset of every report ID, and call @input for each Input
+ * item with the offset its fields start at.
+ */
+static int usb_kbd_parse_items(struct usb_kbd_parser *p, const u8 *desc, unsigned int len,
+                               int (*input)(const struct usb_kbd_parser *p, u32 flags, u32 offset,
+                                            void *ctx),
+                               void *ctx)
+{
+    const u8 *end = desc + len;
+    unsigned int i;
+    u32 *offset;
+    int ret;
+
+    memset(p, 0, sizeof(*p));
+
+    while (desc < end)
+    {
+        u8 prefix = *desc++;
+        unsigned int size;
+        u32 data = 0;
+
+        if (prefix == USB_KBD_ITEM_LONG)
+        {
+            if (desc >= end)
+                return -EINVAL;
+            desc += 2 + desc[0];
+            continue;
+        }
+
+        size = (prefix & 3) == 3 ? 4 : (prefix & 3);
+        if (desc + size > end)
+            return -EINVAL;
+        for (i = 0; i < size; i++)
+            data |= (u32)desc[i] << (8 * i);
+        desc += size;
+
+        switch (prefix & 0xfc)
+        {
+        case USB_KBD_ITEM_INPUT:
+            offset = usb_kbd_parser_offset(p);
+            if (!offset)
+                return -EINVAL;
+            ret = input(p, data, *offset, ctx);
+            if (ret)
+                return ret;
+            *offset += p->g.report_size * p->g.report_count;
+            if (*offset > 8 * 1024)
+                return -EINVAL;
+            usb_kbd_parser_end_locals(p);
+            break;
+        case USB_KBD_ITEM_OUTPUT:
+        case USB_KBD_ITEM_FEATURE:
+        case USB_KBD_ITEM_COLLECTION:
+        case USB_KBD_ITEM_END_COLLECTION:
+            usb_kbd_parser_end_locals(p);
+            break;
+        case USB_KBD_ITEM_USAGE_PAGE:
+            p->g.usage_page = data;
+            break;
+        case USB_KBD_ITEM_LOGICAL_MIN:
+            p->g.logical_min = usb_kbd_item_signed(data, size);
+            break;
+        case USB_KBD_ITEM_LOGICAL_MAX:
+            p->g.logical_max = usb_kbd_item_signed(data, size);
+            break;
+        case USB_KBD_ITEM_REPORT_SIZE:
+            p->g.report_size = data;
+            break;
+        case USB_KBD_ITEM_REPORT_ID:
+            if (!data || data > 255)
+                return -EINVAL;
+            p->g.report_id = data;
+            break;
+        case USB_KBD_ITEM_REPORT_COUNT:
+            p->g.report_count = data;
+            break;
+        case USB_KBD_ITEM_PUSH:
+            if (p->depth == USB_KBD_PARSE_STACK)
+                return -EINVAL;
+            p->stack[p->depth++] = p->g;
+            break;
+        case USB_KBD_ITEM_POP:
+            if (!p->depth)
+                return -EINVAL;
+            p->g = p->stack[--p->depth];
+            break;
+        case USB_KBD_ITEM_USAGE:
+            data = size == 4 ? data : (p->g.usage_page << 16) | data;
+            if (!p->have_usage)
+            {
+                p->usage = data;
+                p->have_usage = true;
+            }
+            if (p->nusages < USB_KBD_PARSE_USAGES)
+                p->usages[p->nusages++] = data;
+            break;
+        case USB_KBD_ITEM_USAGE_MIN:
+            p->usage_min = data & 0xffff;
+            p->have_min = true;
+            break;
+        case USB_KBD_ITEM_USAGE_MAX:
+            p->usage_max = data & 0xffff;
+            p->have_max = true;
+            break;
+        default:
+            /* Units, designators, strings, ... are not needed */
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Dense number of an extended usage, USB_KBD_CONSUMER_NONE if it has no key */
+static u8 usb_kbd_consumer_dense(u32 usage)
+{
+    unsigned int lo = 0, hi = usb_kbd_consumer_nusages;
+
+    while (lo < hi)
+    {
+        unsigned int mid = (lo + hi) / 2;
+
+        if (usb_kbd_consumer_usages[mid].usage < usage)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < usb_kbd_consumer_nusages && usb_kbd_consumer_usages[lo].usage == usage)
+        return lo;
+    return USB_KBD_CONSUMER_NONE;
+}
+
+/*
+ * Input item callback for usb_kbd_parse_consumer_desc().  Fields the
+ * decoder cannot use (constants, multi-bit variables such as a volume
+ * dial, pages without keys) are skipped rather than failing the parse.
+ */
+static int usb_kbd_parser_consumer_input(const struct usb_kbd_parser *p, u32 flags, u32 offset, void *ctx)
+{
+    struct usb_kbd_consumer_layout *layout = ctx;
+    struct usb_kbd_consumer_field *f;
+    u32 page = usb_kbd_parser_page(p);
+    s32 max = p->g.logical_max;
+    unsigned int i, nvalues;
+    u64 mask = 0;
+
+    if ((flags & USB_KBD_INPUT_CONSTANT) || !p->g.report_count || p->g.report_count > 255 ||
+        (page != USB_KBD_PAGE_CONSUMER && page != USB_KBD_PAGE_GENERIC_DESKTOP))
+        return 0;
+    if (layout->nfields == USB_KBD_CONSUMER_MAX_FIELDS)
+        return 0;
+
+    if (flags & USB_KBD_INPUT_VARIABLE)
+    {
+        if (p->g.report_size != 1)
+            return 0;
+        nvalues = p->g.report_count;
+    }
+    else
+    {
+        if (!p->g.report_size || p->g.report_size > 16 || p->g.logical_min < 0)
+            return 0;
+        /* A 1-byte Logical Maximum of 0xff reads as -1 */
+        if (max < p->g.logical_min)
+            max = (1 << p->g.report_size) - 1;
+        nvalues = max - p->g.logical_min + 1;
+    }
+    if (nvalues > USB_KBD_CONSUMER_MAP_SIZE - layout->nmap)
+        return 0;
+
+    f = &layout->fields[layout->nfields];
+    for (i = 0; i < nvalues; i++)
+    {
+        u32 usage = 0;
+        u8 d;
+
+        /* Bit i of a variable field, or array value logical_min + i */
+        if (p->have_min)
+            usage = (page << 16) | (p->usage_min + i);
+        else if (p->nusages)
+            usage = p->usages[i < p->nusages ? i : p->nusages - 1];
+        d = usage ? usb_kbd_consumer_dense(usage) : USB_KBD_CONSUMER_NONE;
+        if (p->have_min && p->have_max && p->usage_min + i > p->usage_max)
+            d = USB_KBD_CONSUMER_NONE;
+        layout->dense[layout->nmap + i] = d;
+        if (d != USB_KBD_CONSUMER_NONE)
+            mask |= 1ULL << d;
+    }
+    if (!mask)
+        return 0;
+
+    f->bit_offset = offset;
+    f->map = layout->nmap;
+    f->count = p->g.report_count;
+    f->nvalues = nvalues;
+    f->logical_min = p->g.logical_min;
+    f->report_id = p->g.report_id;
+    f->size = p->g.report_size;
+    f->variable = flags & USB_KBD_INPUT_VARIABLE;
+    f->mask = mask;
+    layout->nmap += nvalues;
+    layout->nfields++;
+    return 0;
+}
+
+int usb_kbd_parse_consumer_desc(const u8 *desc, unsigned int len,
+                                struct usb_kbd_consumer_layout *layout)
+{
+    struct usb_kbd_parser p;
+    int ret;
+
+    memset(layout, 0, sizeof(*layout));
+    ret = usb_kbd_parse_items(&p, desc, len, usb_kbd_parser_consumer_input, layout);
+    if (ret)
+        return ret;
+    return layout->nfields ? 0 : -ENOENT;
+}
+
+int usb_kbd_parse_report_desc(const u8 *desc, unsigned int len,
+                              struct usb_kbd_layout *layout)
+{
+    struct usb_kbd_keyboard_parse kp = {.layout = layout};
+    struct usb_kbd_parser p;
+    unsigned int i;
+    int ret;
+
+    memset(layout, 0, sizeof(*layout));
+    ret = usb_kbd_parse_items(&p, desc, len, usb_kbd_parser_input, &kp);
+    if (ret)
+        return ret;
+    if (!kp.chosen)
+        return -EINVAL;
+
+    for (i = 0; i < p.nids; i++)
+        if (p.ids[i] == layout->report_id)
+            layout->report_len = (p.offsets[i] + 7) / 8;
+    return 0;
+}
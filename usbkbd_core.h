@@ -0,0 +1,281 @@
+/*
+ * Report decoding core for the usbkbd driver.
+ *
+ * Nothing in here touches the USB or input layers: the core takes raw
+ * report bytes and produces a list of key events.  The same source is
+ * linked into usbkbd.ko and into the userspace replay harness
+ * (kbd_replay), so the interrupt hot path can be timed without hardware.
+ */
+#ifndef USBKBD_CORE_H
+#define USBKBD_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#define usb_kbd_ctz64(x) __ffs64(x)
+#define usb_kbd_ilog2_64(x) (fls64(x) - 1)
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int32_t s32;
+#define usb_kbd_ctz64(x) __builtin_ctzll(x)
+#define usb_kbd_ilog2_64(x) (63 - __builtin_clzll(x))
+#endif
+
+#define USB_KBD_BOOT_REPORT_LEN 8
+#define USB_KBD_BOOT_KEYS 6
+
+#define USB_KBD_MOD_USAGE 0xe0 /* LeftControl, first bit of report byte 0 */
+
+/*
+ * Event buffer size.  A boot report changes at most 20 usages (six slots
+ * released, six pressed, eight modifiers); an NKRO bitmap report can in
+ * principle change every usage at once.
+ */
+#define USB_KBD_CORE_MAX_EVENTS 256
+
+#define USB_KBD_MAX_BITFIELDS 4
+#define USB_KBD_MAX_ARRAY_KEYS 32
+
+/* One bit per HID keyboard usage, 0x00..0xff */
+#define USB_KBD_STATE_WORDS (256 / 64)
+
+struct usb_kbd_event
+{
+    u16 code;    /* translated keycode, 0 if the scancode is unmapped */
+    u8 scancode; /* HID usage ID from the report */
+    s8 value;    /* 1 = press, 0 = release */
+};
+
+#define USB_KBD_KEYMAP_SIZE 256
+
+struct usb_kbd_core
+{
+    u64 pressed[USB_KBD_STATE_WORDS];
+    /* keycode sent on press, so releases survive a keymap change */
+    u16 active[USB_KBD_KEYMAP_SIZE];
+};
+
+/* Run of 1-bit variable fields on the keyboard page (modifiers, NKRO bitmap) */
+struct usb_kbd_bitfield
+{
+    u16 bit_offset;  /* from the start of the report, report ID included */
+    u16 first_usage;
+    u16 count;
+};
+
+/*
+ * Input report layout extracted from a HID report descriptor at probe
+ * time.  The completion handler only ever reads this, it never parses.
+ */
+struct usb_kbd_layout
+{
+    u8 report_id;      /* 0 if the device does not use report IDs */
+    u8 nbitfields;
+    u16 report_len;    /* bytes, report ID included */
+    struct usb_kbd_bitfield bitfields[USB_KBD_MAX_BITFIELDS];
+    u16 array_offset;  /* bit offset of the 8-bit keycode array */
+    u8 array_count;    /* 0 if the report has no array field */
+    u8 array_base;     /* usage = value + array_base */
+};
+
+extern const unsigned char usb_kbd_keycode[256];
+
+void usb_kbd_core_init(struct usb_kbd_core *core);
+
+/* Fill @keymap (USB_KBD_KEYMAP_SIZE entries) with the driver's default layout */
+void usb_kbd_core_default_keymap(u16 *keymap);
+
+/*
+ * Diff a boot protocol report against the pressed-key bitmap and fill
+ * @events (at least USB_KBD_CORE_MAX_EVENTS entries) with releases first,
+ * then presses, each in usage order.  Presses are translated through
+ * @keymap; releases reuse the keycode of the matching press.  Returns the
+ * event count.
+ */
+unsigned int usb_kbd_core_process(struct usb_kbd_core *core, const u16 *keymap,
+                                  const u8 *report, struct usb_kbd_event *events);
+
+/*
+ * Find the keyboard input report in a HID report descriptor.  Returns 0
+ * and fills @layout, or -EINVAL if the descriptor has no keyboard-page
+ * input fields this core can decode.
+ */
+int usb_kbd_parse_report_desc(const u8 *desc, unsigned int len,
+                              struct usb_kbd_layout *layout);
+
+/*
+ * Same as usb_kbd_core_process() for a report described by @layout.
+ * Reports that are too short or carry another report ID yield no events.
+ */
+unsigned int usb_kbd_core_process_layout(struct usb_kbd_core *core, const u16 *keymap,
+                                         const struct usb_kbd_layout *layout,
+                                         const u8 *report, unsigned int len,
+                                         struct usb_kbd_event *events);
+
+/*
+ * Chatter filter for worn switches.  A press that comes less than
+ * window_ms[scancode] after the last release of the same key is
+ * swallowed, together with its release, and counted in chatter[].  Time
+ * comes from the report timestamps, so no timer is involved and a
+ * report costs a couple of loads per changed key.
+ */
+struct usb_kbd_debounce
+{
+    u64 released[USB_KBD_KEYMAP_SIZE];  /* ns of the last release, 0 = none yet */
+    u64 swallowed[USB_KBD_STATE_WORDS]; /* held keys whose press was swallowed */
+    u32 chatter[USB_KBD_KEYMAP_SIZE];   /* presses swallowed per scancode */
+    u8 window_ms[USB_KBD_KEYMAP_SIZE];  /* 0 = not filtered */
+};
+
+/* Forget the key state, as on open; windows and counters are kept */
+void usb_kbd_debounce_reset(struct usb_kbd_debounce *db);
+
+/*
+ * Drop the chatter from the @n events of a report taken at @now ns,
+ * compacting @events in place.  Returns the events left.
+ */
+unsigned int usb_kbd_debounce_filter(struct usb_kbd_debounce *db, struct usb_kbd_event *events,
+                                     unsigned int n, u64 now);
+
+/*
+ * LED policy: what goes into the LED output report when an LED changes.
+ * Entries are indexed by the current mode, the LED that changed (its
+ * input LED code, LED_NUML..LED_KANA) and the state of all five LEDs,
+ * bit n being LED code n, which is also the HID LED report layout.  Each
+ * gives the byte to send and the next mode, so an LED event costs one
+ * table load.
+ */
+#define USB_KBD_LED_MODES 4
+#define USB_KBD_LED_CODES 5
+#define USB_KBD_LED_STATES (1 << USB_KBD_LED_CODES)
+#define USB_KBD_LED_CAPS_BIT 0x02
+
+struct usb_kbd_led_entry
+{
+    u8 out;
+    u8 next;
+};
+
+struct usb_kbd_led_policy
+{
+    struct usb_kbd_led_entry entry[USB_KBD_LED_MODES][USB_KBD_LED_CODES][USB_KBD_LED_STATES];
+};
+
+/*
+ * The built-in policy.  Mode 0 passes the LEDs through; Num Lock while
+ * Caps Lock is off enters mode 1, which holds the Caps Lock LED on until
+ * the next Num Lock.  Modes 2 and 3 pass through.
+ */
+void usb_kbd_led_policy_default(struct usb_kbd_led_policy *policy);
+
+/* Every mode passes the LEDs through and stays */
+void usb_kbd_led_policy_clear(struct usb_kbd_led_policy *policy);
+
+/*
+ * Rewrite the entries for @mode and @code (-1 for all) whose state
+ * matches @match under @mask.  They send @out, or the state ORed with
+ * @or_bits if @out is negative, and move to mode @next, or stay if
+ * @next is negative.
+ */
+void usb_kbd_led_policy_set(struct usb_kbd_led_policy *policy, int mode, int code, u8 match, u8 mask,
+                            int out, u8 or_bits, int next);
+
+/*
+ * Consumer-page (media, browser) and system-control keys, as sent on the
+ * second HID interface most keyboards have next to the boot keyboard.
+ * The usages that have a key are numbered densely, so the held ones fit
+ * a u64; at probe time every report bit or array value is mapped to its
+ * dense number, so decoding a report is indexing only.
+ */
+#define USB_KBD_CONSUMER_MAX_FIELDS 8
+#define USB_KBD_CONSUMER_MAP_SIZE 2048 /* dense[] entries, all fields together */
+#define USB_KBD_CONSUMER_NONE 0xff
+
+struct usb_kbd_consumer_usage
+{
+    u32 usage;   /* extended: page << 16 | id */
+    u16 keycode;
+};
+
+/* Sorted by usage; the index is the dense number */
+extern const struct usb_kbd_consumer_usage usb_kbd_consumer_usages[];
+extern const unsigned int usb_kbd_consumer_nusages;
+
+struct usb_kbd_consumer_field
+{
+    u64 mask;        /* dense numbers this field can report */
+    s32 logical_min; /* array fields: value of dense[map] */
+    u16 bit_offset;  /* from the start of the report, report ID included */
+    u16 map;         /* first entry of this field in dense[] */
+    u16 count;       /* values in the report */
+    u16 nvalues;     /* entries in dense[]: one per bit, or per array value */
+    u8 report_id;
+    u8 size;         /* bits per value, 1 for variable fields */
+    bool variable;
+};
+
+struct usb_kbd_consumer_layout
+{
+    u8 nfields;
+    u16 nmap;
+    struct usb_kbd_consumer_field fields[USB_KBD_CONSUMER_MAX_FIELDS];
+    u8 dense[USB_KBD_CONSUMER_MAP_SIZE]; /* bit or array value -> dense number */
+};
+
+/*
+ * Collect the consumer and system-control input fields of a report
+ * descriptor.  Returns -ENOENT if none of them names a known key.
+ */
+int usb_kbd_parse_consumer_desc(const u8 *desc, unsigned int len,
+                                struct usb_kbd_consumer_layout *layout);
+
+/*
+ * Diff a report from the consumer interface against @pressed, the held
+ * dense numbers, and fill @events (at least 64 entries) with releases,
+ * then presses.  The event scancode is the dense number.  Reports with a
+ * report ID no field uses change nothing.
+ */
+unsigned int usb_kbd_consumer_process(u64 *pressed, const struct usb_kbd_consumer_layout *layout,
+                                      const u8 *report, unsigned int len, struct usb_kbd_event *events);
+
+/*
+ * log2 latency histogram.  Bucket i counts samples in [2^i, 2^(i+1)) ns,
+ * bucket 0 also takes 0 and the last bucket takes everything above.
+ */
+#define USB_KBD_HIST_BUCKETS 32
+
+struct usb_kbd_hist
+{
+    u64 count;
+    u64 sum;
+    u64 max;
+    u64 buckets[USB_KBD_HIST_BUCKETS];
+};
+
+static inline void usb_kbd_hist_add(struct usb_kbd_hist *h, u64 ns)
+{
+    unsigned int b = ns ? usb_kbd_ilog2_64(ns) : 0;
+
+    if (b >= USB_KBD_HIST_BUCKETS)
+        b = USB_KBD_HIST_BUCKETS - 1;
+    h->buckets[b]++;
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+/* Upper bound (ns) of the bucket holding the @pct-th percentile, 0 if empty */
+u64 usb_kbd_hist_percentile(const struct usb_kbd_hist *h, unsigned int pct);
+
+#endif /* USBKBD_CORE_H */
@@ -0,0 +1,63 @@
+/*
+ * Build-time generator for usbkbd_keybits.h.
+ *
+ * Turns the scancode translation table, usb_kbd_keycode[], into the
+ * input_dev->keybit image the driver would otherwise rebuild at every
+ * probe: every keycode the table can produce, for 32- and 64-bit longs.
+ *
+ *   ./usbkbd_genkeys > usbkbd_keybits.h
+ *
+ * Built for the host by both the kbuild and the tools half of the
+ * Makefile, so the header always follows the table.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "usbkbd_core.c"
+
+static void print_keybit(const unsigned char *bits, unsigned int word_bytes)
+{
+    unsigned int w, b, words = KEY_CNT / 8 / word_bytes;
+
+    for (w = 0; w < words; w++) {
+        unsigned long long v = 0;
+
+        for (b = 0; b < word_bytes; b++)
+            v |= (unsigned long long)bits[w * word_bytes + b] << (8 * b);
+        printf("%s0x%0*llxUL,%s", w % 4 ? " " : "    ", word_bytes * 2, v, w % 4 == 3 ? "\n" : "");
+    }
+    if (words % 4)
+        printf("\n");
+}
+
+int main(void)
+{
+    unsigned char bits[KEY_CNT / 8];
+    unsigned int sc, k;
+
+    /* The modifier bits are decoded as usages 0xe0..0xe7 */
+    if (usb_kbd_keycode[USB_KBD_MOD_USAGE] != KEY_LEFTCTRL) {
+        fprintf(stderr, "usb_kbd_keycode[%#x] is not KEY_LEFTCTRL, table misaligned\n", USB_KBD_MOD_USAGE);
+        return 1;
+    }
+
+    memset(bits, 0, sizeof(bits));
+    for (sc = 0; sc < 256; sc++) {
+        k = usb_kbd_keycode[sc];
+        if (k)
+            bits[k / 8] |= 1 << (k % 8);
+    }
+
+    printf("/* Generated by usbkbd_genkeys from usb_kbd_keycode[], do not edit */\n"
+           "#ifndef USBKBD_KEYBITS_H\n"
+           "#define USBKBD_KEYBITS_H\n\n");
+
+    printf("/* Every keycode usb_kbd_keycode[] produces, as an input_dev->keybit image */\n"
+           "static const unsigned long usb_kbd_keybit[] = {\n"
+           "#if __SIZEOF_LONG__ == 8\n");
+    print_keybit(bits, 8);
+    printf("#else\n");
+    print_keybit(bits, 4);
+    printf("#endif\n};\n\n#endif /* USBKBD_KEYBITS_H */\n");
+    return 0;
+}
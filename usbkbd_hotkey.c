@@ -0,0 +1,313 @@
+/*
+ * In-driver hotkey engine: chords loaded by subscribers of
+ * /dev/usbkbd_hotkey are matched against every decoded report, so a
+ * daemon waiting for one hotkey only wakes when it fires instead of
+ * reading every key event from evdev.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/input.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/kfifo.h>
+#include <linux/rcupdate.h>
+#include <linux/uaccess.h>
+
+#include "usbkbd_hotkey.h"
+
+#define USB_KBD_HOTKEY_QUEUE 64
+
+/* One open file of /dev/usbkbd_hotkey */
+struct usb_kbd_hotkey_sub
+{
+    struct list_head node;         /* on usb_kbd_hotkey_subs */
+    unsigned int nr;
+    struct usb_kbd_hotkey chords[USB_KBD_HOTKEY_MAX];
+    spinlock_t lock;               /* serializes producers, one per keyboard */
+    struct mutex read_mutex;       /* the kfifo has a single consumer */
+    DECLARE_KFIFO(fifo, struct usb_kbd_hotkey_event, USB_KBD_HOTKEY_QUEUE);
+    wait_queue_head_t wait;
+};
+
+struct usb_kbd_hotkey_chord
+{
+    u32 id;
+    u8 mods;
+    u8 flags;
+    struct usb_kbd_hotkey_sub *sub; /* NULL once the subscriber has left */
+};
+
+/*
+ * The chords of every subscriber grouped by keycode: those for keycode k
+ * are chords[first[k]] up to chords[first[k + 1]].  Rebuilt whenever a
+ * subscriber's table changes and published with RCU; a key without
+ * chords costs one lookup.
+ */
+struct usb_kbd_hotkey_table
+{
+    u16 first[KEY_CNT + 1];
+    struct usb_kbd_hotkey_chord chords[];
+};
+
+struct usb_kbd_hotkey_table __rcu *usb_kbd_hotkeys;
+DEFINE_STATIC_KEY_FALSE(usb_kbd_hotkeys_on);
+static LIST_HEAD(usb_kbd_hotkey_subs);
+static DEFINE_MUTEX(usb_kbd_hotkey_mutex); /* subscriber list and tables */
+
+static void usb_kbd_hotkey_fire(struct usb_kbd_hotkey_sub *sub, const struct usb_kbd_hotkey_chord *chord,
+                                const struct usb_kbd_event *ev, u8 mods, u64 ns)
+{
+    struct usb_kbd_hotkey_event e = {
+        .ns = ns,
+        .id = chord->id,
+        .keycode = ev->code,
+        .mods = mods,
+        .value = ev->value,
+    };
+    unsigned long flags;
+
+    spin_lock_irqsave(&sub->lock, flags);
+    kfifo_put(&sub->fifo, e);
+    spin_unlock_irqrestore(&sub->lock, flags);
+    wake_up_interruptible_poll(&sub->wait, EPOLLIN | EPOLLRDNORM);
+}
+
+void usb_kbd_hotkey_match(const struct usb_kbd_hotkey_table *table, const struct usb_kbd_event *events,
+                          unsigned int n, u8 mods, u64 ns)
+{
+    u8 fold = (mods | mods >> 4) & 0x0f;
+    unsigned int i, c;
+
+    for (i = 0; i < n; i++)
+    {
+        const struct usb_kbd_event *ev = &events[i];
+        u8 edge = ev->value ? USB_KBD_HOTKEY_PRESS : USB_KBD_HOTKEY_RELEASE;
+
+        /* Unmapped scancodes have code 0, which never has chords */
+        for (c = table->first[ev->code]; c < table->first[ev->code + 1]; c++)
+        {
+            const struct usb_kbd_hotkey_chord *chord = &table->chords[c];
+            struct usb_kbd_hotkey_sub *sub;
+
+            if (!(chord->flags & edge) ||
+                (!(chord->flags & USB_KBD_HOTKEY_ANY_MODS) && chord->mods != fold))
+                continue;
+            sub = READ_ONCE(chord->sub);
+            if (sub)
+                usb_kbd_hotkey_fire(sub, chord, ev, fold, ns);
+        }
+    }
+}
+
+/*
+ * Rebuild the table from every subscriber's chords, counting sort on the
+ * keycode, and publish it.  Once this returns no reader can see the old
+ * table or any subscriber that has left the list.
+ */
+static int usb_kbd_hotkey_rebuild(void)
+{
+    struct usb_kbd_hotkey_table *new = NULL, *old;
+    struct usb_kbd_hotkey_sub *sub;
+    unsigned int total = 0, i, k;
+
+    lockdep_assert_held(&usb_kbd_hotkey_mutex);
+
+    list_for_each_entry(sub, &usb_kbd_hotkey_subs, node)
+        total += sub->nr;
+    if (total > U16_MAX)
+        return -ENOSPC;
+
+    if (total)
+    {
+        new = kvzalloc(struct_size(new, chords, total), GFP_KERNEL);
+        if (!new)
+            return -ENOMEM;
+
+        /* first[k] counts, then ends, then after placement starts of keycode k */
+        list_for_each_entry(sub, &usb_kbd_hotkey_subs, node)
+            for (i = 0; i < sub->nr; i++)
+                new->first[sub->chords[i].keycode]++;
+        for (k = 1; k < KEY_CNT; k++)
+            new->first[k] += new->first[k - 1];
+        new->first[KEY_CNT] = total;
+
+        list_for_each_entry(sub, &usb_kbd_hotkey_subs, node)
+            for (i = 0; i < sub->nr; i++)
+            {
+                struct usb_kbd_hotkey_chord *chord =
+                    &new->chords[--new->first[sub->chords[i].keycode]];
+
+                chord->id = sub->chords[i].id;
+                chord->mods = sub->chords[i].mods;
+                chord->flags = sub->chords[i].flags;
+                chord->sub = sub;
+            }
+    }
+
+    /* Keyboards only look at the table while the key is on */
+    if (!new)
+        static_branch_disable(&usb_kbd_hotkeys_on);
+    old = rcu_replace_pointer(usb_kbd_hotkeys, new, lockdep_is_held(&usb_kbd_hotkey_mutex));
+    if (new)
+        static_branch_enable(&usb_kbd_hotkeys_on);
+    synchronize_rcu();
+    kvfree(old);
+    return 0;
+}
+
+static int usb_kbd_hotkey_open(struct inode *inode, struct file *file)
+{
+    struct usb_kbd_hotkey_sub *sub;
+
+    sub = kzalloc(sizeof(*sub), GFP_KERNEL);
+    if (!sub)
+        return -ENOMEM;
+
+    spin_lock_init(&sub->lock);
+    mutex_init(&sub->read_mutex);
+    INIT_KFIFO(sub->fifo);
+    init_waitqueue_head(&sub->wait);
+
+    mutex_lock(&usb_kbd_hotkey_mutex);
+    list_add_tail(&sub->node, &usb_kbd_hotkey_subs);
+    mutex_unlock(&usb_kbd_hotkey_mutex);
+
+    file->private_data = sub;
+    return nonseekable_open(inode, file);
+}
+
+/*
+ * The subscriber must be out of the table before it is freed.  If the
+ * smaller table cannot be allocated, its chords stay in the published
+ * one but point nowhere, and the next rebuild drops them.
+ */
+static int usb_kbd_hotkey_release(struct inode *inode, struct file *file)
+{
+    struct usb_kbd_hotkey_sub *sub = file->private_data;
+    struct usb_kbd_hotkey_table *table;
+    unsigned int c;
+
+    mutex_lock(&usb_kbd_hotkey_mutex);
+    list_del(&sub->node);
+    if (sub->nr && usb_kbd_hotkey_rebuild())
+    {
+        table = rcu_dereference_protected(usb_kbd_hotkeys, lockdep_is_held(&usb_kbd_hotkey_mutex));
+        for (c = 0; c < table->first[KEY_CNT]; c++)
+            if (table->chords[c].sub == sub)
+                WRITE_ONCE(table->chords[c].sub, NULL);
+        synchronize_rcu();
+    }
+    mutex_unlock(&usb_kbd_hotkey_mutex);
+
+    kfree(sub);
+    return 0;
+}
+
+static long usb_kbd_hotkey_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct usb_kbd_hotkey_sub *sub = file->private_data;
+    struct usb_kbd_hotkey hk;
+    unsigned int nr;
+    int error;
+
+    switch (cmd)
+    {
+    case USB_KBD_IOC_ADD_HOTKEY:
+        if (copy_from_user(&hk, (void __user *)arg, sizeof(hk)))
+            return -EFAULT;
+        if (!hk.keycode || hk.keycode > KEY_MAX || hk.mods > 0x0f ||
+            !(hk.flags & (USB_KBD_HOTKEY_PRESS | USB_KBD_HOTKEY_RELEASE)) ||
+            hk.flags & ~(USB_KBD_HOTKEY_PRESS | USB_KBD_HOTKEY_RELEASE | USB_KBD_HOTKEY_ANY_MODS))
+            return -EINVAL;
+
+        mutex_lock(&usb_kbd_hotkey_mutex);
+        if (sub->nr == USB_KBD_HOTKEY_MAX)
+            error = -ENOSPC;
+        else
+        {
+            sub->chords[sub->nr++] = hk;
+            error = usb_kbd_hotkey_rebuild();
+            if (error)
+                sub->nr--;
+        }
+        mutex_unlock(&usb_kbd_hotkey_mutex);
+        return error;
+
+    case USB_KBD_IOC_CLEAR_HOTKEYS:
+        mutex_lock(&usb_kbd_hotkey_mutex);
+        nr = sub->nr;
+        sub->nr = 0;
+        error = usb_kbd_hotkey_rebuild();
+        if (error)
+            sub->nr = nr; /* still in the published table */
+        mutex_unlock(&usb_kbd_hotkey_mutex);
+        return error;
+    }
+
+    return -ENOTTY;
+}
+
+static ssize_t usb_kbd_hotkey_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    struct usb_kbd_hotkey_sub *sub = file->private_data;
+    unsigned int copied;
+    int error;
+
+    if (count < sizeof(struct usb_kbd_hotkey_event))
+        return -EINVAL;
+
+    if (mutex_lock_interruptible(&sub->read_mutex))
+        return -ERESTARTSYS;
+    while (kfifo_is_empty(&sub->fifo))
+    {
+        mutex_unlock(&sub->read_mutex);
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(sub->wait, !kfifo_is_empty(&sub->fifo)))
+            return -ERESTARTSYS;
+        if (mutex_lock_interruptible(&sub->read_mutex))
+            return -ERESTARTSYS;
+    }
+    error = kfifo_to_user(&sub->fifo, buf, count, &copied);
+    mutex_unlock(&sub->read_mutex);
+
+    return error ? error : copied;
+}
+
+static __poll_t usb_kbd_hotkey_poll(struct file *file, poll_table *wait)
+{
+    struct usb_kbd_hotkey_sub *sub = file->private_data;
+
+    poll_wait(file, &sub->wait, wait);
+    return kfifo_is_empty(&sub->fifo) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+static const struct file_operations usb_kbd_hotkey_fops = {
+    .owner = THIS_MODULE,
+    .open = usb_kbd_hotkey_open,
+    .release = usb_kbd_hotkey_release,
+    .read = usb_kbd_hotkey_read,
+    .poll = usb_kbd_hotkey_poll,
+    .unlocked_ioctl = usb_kbd_hotkey_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+};
+
+static struct miscdevice usb_kbd_hotkey_misc = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "usbkbd_hotkey",
+    .fops = &usb_kbd_hotkey_fops,
+};
+
+int usb_kbd_hotkey_init(void)
+{
+    return misc_register(&usb_kbd_hotkey_misc);
+}
+
+void usb_kbd_hotkey_exit(void)
+{
+    /* Open files pin the module, so no subscribers or table are left */
+    misc_deregister(&usb_kbd_hotkey_misc);
+}
@@ -0,0 +1,75 @@
+/*
+ * Hotkey notifications from usbkbd, shared between the driver and
+ * userspace.
+ *
+ * Every open file of /dev/usbkbd_hotkey is one subscriber with its own
+ * table of up to USB_KBD_HOTKEY_MAX chords, loaded with
+ * USB_KBD_IOC_ADD_HOTKEY.  The driver matches each decoded report against
+ * the chords of all subscribers with one table lookup per key event and
+ * queues a struct usb_kbd_hotkey_event to the subscriber whose chord
+ * fired.  The file is pollable; read() returns whole events, blocking
+ * unless O_NONBLOCK.  A subscriber whose queue is full loses new events.
+ * kbd_hotkey is the reference client.
+ */
+#ifndef USBKBD_HOTKEY_H
+#define USBKBD_HOTKEY_H
+
+#include <linux/ioctl.h>
+
+#include "usbkbd_core.h"
+
+#define USB_KBD_HOTKEY_MAX 64
+
+/* Modifiers, either side: the HID modifier byte folded onto its low nibble */
+#define USB_KBD_HOTKEY_CTRL 0x01
+#define USB_KBD_HOTKEY_SHIFT 0x02
+#define USB_KBD_HOTKEY_ALT 0x04
+#define USB_KBD_HOTKEY_META 0x08
+
+/* struct usb_kbd_hotkey flags */
+#define USB_KBD_HOTKEY_PRESS 0x01
+#define USB_KBD_HOTKEY_RELEASE 0x02
+#define USB_KBD_HOTKEY_ANY_MODS 0x04 /* ignore mods */
+
+struct usb_kbd_hotkey
+{
+    u32 id;      /* returned in the event, chosen by the subscriber */
+    u16 keycode; /* after the keymap, as evdev would report it */
+    u8 mods;     /* exact modifier set held after the report */
+    u8 flags;
+};
+
+struct usb_kbd_hotkey_event
+{
+    u64 ns;      /* CLOCK_MONOTONIC event timestamp, as evdev would report it */
+    u32 id;
+    u16 keycode;
+    u8 mods;
+    u8 value;    /* 1 = press, 0 = release */
+};
+
+#define USB_KBD_IOC_ADD_HOTKEY _IOW('k', 0x40, struct usb_kbd_hotkey)
+#define USB_KBD_IOC_CLEAR_HOTKEYS _IO('k', 0x41)
+
+#ifdef __KERNEL__
+#include <linux/jump_label.h>
+
+struct usb_kbd_hotkey_table;
+
+extern struct usb_kbd_hotkey_table __rcu *usb_kbd_hotkeys;
+/* On while some subscriber has chords; callers test it before usb_kbd_hotkeys */
+DECLARE_STATIC_KEY_FALSE(usb_kbd_hotkeys_on);
+
+/*
+ * Match the events of one report against @table and queue an event to
+ * every subscriber with a matching chord.  @mods is the HID modifier
+ * byte after the report.  Called under rcu_read_lock(), from any context.
+ */
+void usb_kbd_hotkey_match(const struct usb_kbd_hotkey_table *table, const struct usb_kbd_event *events,
+                          unsigned int n, u8 mods, u64 ns);
+
+int usb_kbd_hotkey_init(void);
+void usb_kbd_hotkey_exit(void);
+#endif
+
+#endif /* USBKBD_HOTKEY_H */
@@ -0,0 +1,2794 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/usb/input.h>
+#include <linux/hid.h>
+#include <linux/rcupdate.h>
+#include <linux/ctype.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/seq_file.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/jump_label.h>
+
+#include "usbkbd_core.h"
+#include "usbkbd_capture.h"
+#include "usbkbd_keybits.h"
+#include "usbkbd_hotkey.h"
+
+#define CREATE_TRACE_POINTS
+#include "usbkbd_trace.h"
+
+#define DRIVER_VERSION "v1.0"
+#define DRIVER_AUTHOR "Kma software developer"
+#define DRIVER_DESC "USB HID Boot Protocol keyboard driver"
+#define DRIVER_LICENSE "GPL"
+#define USB_VENDOR_ID 0x0C45  // Vendor ID từ Hardware Ids
+#define USB_PRODUCT_ID 0x760A // Product ID từ Hardware Ids
+MODULE_AUTHOR(DRIVER_AUTHOR);
+MODULE_DESCRIPTION(DRIVER_DESC);
+MODULE_LICENSE(DRIVER_LICENSE);
+
+/*
+ * Per-device quirks, carried in driver_info of the id table entry that
+ * matched.  Entries for specific keyboards go before the generic one.
+ */
+struct usb_kbd_quirks
+{
+    unsigned int flags;
+    unsigned int poll_interval_us; /* unless poll_interval_us is set, 0 = endpoint descriptor */
+    u8 led_report_id;              /* the LED output report starts with this ID, 0 = none */
+};
+
+#define USB_KBD_QUIRK_BOOT_PROTOCOL BIT(0) /* stay on the boot protocol even with report_protocol */
+#define USB_KBD_QUIRK_RESET_RESUME BIT(1)  /* loses its state while suspended */
+
+static const struct usb_kbd_quirks usb_kbd_no_quirks;
+
+/* The keyboard this driver was first written against, a boot protocol 6KRO board */
+static const struct usb_kbd_quirks usb_kbd_quirks_0c45_760a = {
+    .flags = USB_KBD_QUIRK_BOOT_PROTOCOL,
+};
+
+static bool report_protocol;
+module_param(report_protocol, bool, 0444);
+MODULE_PARM_DESC(report_protocol, "Use HID report protocol (NKRO) when the report descriptor allows it");
+
+#define USB_KBD_MAX_IRQ_URBS 16
+
+static unsigned int irq_urbs = 2;
+module_param(irq_urbs, uint, 0444);
+MODULE_PARM_DESC(irq_urbs, "Interrupt URBs kept in flight per keyboard (1-16)");
+
+static unsigned int led_interval_ms = 10;
+module_param(led_interval_ms, uint, 0644);
+MODULE_PARM_DESC(led_interval_ms, "Minimum time between LED control transfers, in ms");
+
+#define USB_KBD_LED_RETRY_MS 100U
+
+static unsigned int reset_after_errors = 64;
+module_param(reset_after_errors, uint, 0644);
+MODULE_PARM_DESC(reset_after_errors, "Consecutive interrupt URB errors before the device is reset, 0 = never");
+
+static bool autosuspend = true;
+module_param(autosuspend, bool, 0644);
+MODULE_PARM_DESC(autosuspend, "Turn on autosuspend for newly bound keyboards (power/control=auto)");
+
+/* A report this long after resume was not what woke the device */
+#define USB_KBD_WAKE_WINDOW_NS (1000ULL * NSEC_PER_MSEC)
+
+/* Resubmission delay after the n-th consecutive URB error: 2^(n-1) ms, capped */
+#define USB_KBD_BACKOFF_MAX_MS 1024U
+
+static unsigned int capture_records = 4096;
+module_param(capture_records, uint, 0644);
+MODULE_PARM_DESC(capture_records, "Size of the raw report capture ring, rounded up to a power of two");
+
+static unsigned int diag_interval_s = 30;
+module_param(diag_interval_s, uint, 0644);
+MODULE_PARM_DESC(diag_interval_s, "Minimum time between diagnostic summary lines per keyboard, in s");
+
+static unsigned int poll_interval_us;
+module_param(poll_interval_us, uint, 0644);
+MODULE_PARM_DESC(poll_interval_us, "Interrupt endpoint polling interval for newly bound keyboards, in us, 0 = endpoint descriptor");
+
+#define USB_KBD_MAX_QUEUE 4096U
+
+static unsigned int report_queue;
+module_param(report_queue, uint, 0444);
+MODULE_PARM_DESC(report_queue, "Queue reports for a high priority workqueue to decode, ring size (up to 4096), 0 = decode in the completion handler");
+
+static unsigned int debounce_ms;
+module_param(debounce_ms, uint, 0644);
+MODULE_PARM_DESC(debounce_ms, "Swallow a key press this soon after the key's release on newly bound keyboards, in ms (up to 255), 0 = off");
+
+static bool aggregate;
+module_param(aggregate, bool, 0444);
+MODULE_PARM_DESC(aggregate, "Also merge the keys of every keyboard into one \"usbkbd aggregate\" input device");
+
+/*
+ * Errors are counted per errno.  These are the statuses USB host
+ * controllers actually report; anything else lands in slot 0.
+ */
+static const int usb_kbd_errnos[] = {
+    0, EPROTO, EILSEQ, ETIME, EPIPE, EOVERFLOW, EREMOTEIO, ENODEV,
+    ENOSR, EXDEV, ECOMM, EPERM, EMSGSIZE, ENOSPC, EINVAL, ENOMEM,
+};
+#define USB_KBD_ERR_SLOTS ARRAY_SIZE(usb_kbd_errnos)
+
+/* Per-CPU diagnostic counters, summed when read */
+struct usb_kbd_stats
+{
+    u32 unknown[256];                   /* unmapped scancode presses */
+    u32 urb_status[USB_KBD_ERR_SLOTS];  /* interrupt URB error completions */
+    u32 resubmit[USB_KBD_ERR_SLOTS];    /* interrupt URB resubmit failures */
+    u32 led_status[USB_KBD_ERR_SLOTS];  /* LED submit failures and error completions */
+    u32 mode_switches;
+    unsigned long reports_dropped;      /* error completions and failed resubmits */
+};
+
+static unsigned int usb_kbd_err_slot(int error)
+{
+    unsigned int i;
+
+    for (i = 1; i < USB_KBD_ERR_SLOTS; i++)
+        if (usb_kbd_errnos[i] == -error)
+            return i;
+    return 0;
+}
+
+/*
+ * The keyboard's companion HID interface with the media, browser and
+ * system-control keys, claimed by the keyboard's probe.  Its reports
+ * come in on one URB, the last of the ring, and go out on the
+ * keyboard's input device.
+ */
+struct usb_kbd_consumer
+{
+    struct usb_interface *intf;
+    u64 pressed;                  /* dense numbers held */
+    unsigned long reports;
+    unsigned char *buf;
+    dma_addr_t dma;
+    unsigned int len;
+    struct usb_kbd_event events[64];
+    struct usb_kbd_consumer_layout layout;
+};
+
+/* Scancode -> keycode table, replaced as a whole and freed after a grace period */
+struct usb_kbd_keymap
+{
+    struct rcu_head rcu;
+    u16 keycode[USB_KBD_KEYMAP_SIZE];
+    unsigned long keybit[BITS_TO_LONGS(KEY_CNT)]; /* keycodes to advertise */
+};
+
+struct usb_kbd_led_rules
+{
+    struct rcu_head rcu;
+    struct usb_kbd_led_policy policy;
+};
+
+struct usb_kbd
+{
+    /* Read by the completion handler for every report: one cache line */
+    struct input_dev *dev;
+    struct usb_device *usbdev;
+    struct usb_kbd_keymap __rcu *keymap;
+    bool report_mode;
+    bool capturing;               /* copy raw reports into the capture ring, picks the handler */
+    bool debouncing;              /* some key has a debounce window, picks the handler */
+    struct usb_kbd_layout layout;
+
+    /* Written by the completion handler for every report */
+    unsigned long reports_received ____cacheline_aligned;
+    unsigned int error_streak;    /* consecutive error completions */
+    /*
+     * report_queue mode: the completion handler produces into this ring
+     * of queue_mask + 1 slots, report_work consumes.  Reports that find
+     * it full are counted in queue_overflows and dropped.
+     */
+    u8 *queue;
+    u32 queue_mask;
+    u32 queue_stride;
+    u32 queue_head;
+    u32 queue_max;                /* deepest the ring has been */
+    unsigned long queue_overflows;
+    struct usb_kbd_hist top_half; /* time in the completion handler */
+    u64 resume_ns;                /* resumed, no report seen yet; 0 otherwise */
+    struct usb_kbd_core core;
+    struct usb_kbd_hist irq_latency; /* URB completion -> input_sync() */
+    struct usb_kbd_event events[USB_KBD_CORE_MAX_EVENTS];
+    struct usb_kbd_debounce debounce;
+    unsigned long agg_held[BITS_TO_LONGS(KEY_CNT)]; /* keys this keyboard holds down in the aggregate */
+
+    u32 queue_tail ____cacheline_aligned; /* written by report_work only */
+    struct work_struct report_work;
+
+    struct usb_interface *intf;
+    struct usb_kbd_stats __percpu *stats;
+    spinlock_t keymap_lock; /* serializes keymap and debounce window updates */
+    unsigned int new_len;
+    unsigned int nr_irq;          /* keyboard report URBs */
+    unsigned int nr_urbs;         /* those plus the consumer URB, if any */
+    struct urb *irq[USB_KBD_MAX_IRQ_URBS + 1], *led;
+    struct usb_kbd_consumer *consumer;
+    struct usb_endpoint_descriptor *endpoint;
+    u8 desc_interval;             /* bInterval as the device reported it */
+    struct mutex io_mutex;        /* open/close against device reset */
+    unsigned int users;           /* own input device and aggregate one, under io_mutex */
+    bool opened;                  /* ring wanted */
+    struct list_head agg_node;    /* under usb_kbd_agg->mutex */
+    bool agg_io;                  /* the aggregate device holds one of users */
+    spinlock_t health_lock;
+    bool io_running;              /* interrupt URBs may be (re)submitted */
+    bool backoff_pending;
+    bool resetting;
+    unsigned long parked;         /* ring slots waiting out the backoff */
+    struct delayed_work backoff_work;
+    unsigned long backoffs;
+    unsigned long resets;
+    bool suspended;               /* under leds_lock */
+    bool led_wakeup;              /* holds an autopm reference to send LEDs */
+    u64 suspend_ns;
+    unsigned long suspends;
+    unsigned long resumes;
+    struct usb_kbd_hist suspended_for;  /* time spent suspended */
+    struct usb_kbd_hist wake_to_report; /* resume -> first report */
+    unsigned char newleds;
+    char name[128];
+    char phys[64];
+    /*
+     * One coherent buffer per device: nr_irq report buffers of new_len
+     * bytes, then the LED report, the quirk's report ID if it has one
+     * and the LED byte.
+     */
+    unsigned char *dma_buf;
+    dma_addr_t dma;
+    size_t dma_len;
+    unsigned char *new;
+    unsigned char *leds;
+    spinlock_t leds_lock;
+    bool led_urb_submitted;
+    bool led_resend;               /* last transfer failed, device state unknown */
+    unsigned long led_last;        /* jiffies of the last LED submit */
+    struct delayed_work led_work;  /* deferred submit when led_interval_ms is not over */
+    u8 led_mode;                     /* under the input core's event_lock */
+    struct usb_kbd_led_rules __rcu *led_rules;
+    struct mutex led_rules_mutex;    /* serializes led_policy writes */
+    struct usb_kbd_hist led_latency; /* LED event -> control transfer acked */
+    u64 led_event_ns;                /* first unacked LED change, 0 if none */
+    struct usb_kbd_stats diag_last;  /* totals at the last summary line */
+    unsigned long diag_next;         /* jiffies before which no summary is printed */
+    struct delayed_work diag_work;
+    struct dentry *debugfs;
+    /*
+     * Capture ring, allocated on first use and kept until disconnect so
+     * that existing mappings stay valid.  The header lives in memory
+     * userspace can write, so the producer keeps its own copies.
+     */
+    struct usb_kbd_capture_header *capture;
+    u64 capture_head;
+    u64 capture_dropped;
+    u32 capture_mask;
+    /*
+     * SET_REPORT setup packet.  The HCD maps it with dma_map_single(), so
+     * it cannot live in the coherent buffer; on its own cache line instead.
+     */
+    struct usb_ctrlrequest cr ____cacheline_aligned;
+};
+
+/* A report waiting in the report_queue ring */
+struct usb_kbd_queued
+{
+    u64 start;     /* URB completion, also the event timestamp */
+    u16 len;
+    bool consumer; /* from the consumer interface */
+    u8 data[];
+};
+
+/*
+ * aggregate mode: one more input device carrying the keys of every bound
+ * keyboard.  refs[] counts the keyboards holding each key down, so a key
+ * held on two keyboards goes up once both let go.  While the aggregate
+ * device is open it keeps the ring of every member running.
+ */
+struct usb_kbd_aggregate
+{
+    struct input_dev *dev;
+    spinlock_t lock;          /* key reports to dev */
+    struct mutex mutex;       /* members and opened */
+    struct list_head members;
+    bool opened;
+    atomic_t refs[KEY_CNT];
+};
+
+static struct dentry *usb_kbd_debugfs_root;
+static struct workqueue_struct *usb_kbd_wq;
+static struct usb_kbd_aggregate *usb_kbd_agg;
+/* usb_kbd_agg is set, patched into the decode path instead of tested per report */
+static DEFINE_STATIC_KEY_FALSE(usb_kbd_agg_on);
+
+static void usb_kbd_stats_sum(struct usb_kbd *kbd, struct usb_kbd_stats *sum)
+{
+    int cpu, i;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu)
+    {
+        const struct usb_kbd_stats *st = per_cpu_ptr(kbd->stats, cpu);
+
+        for (i = 0; i < ARRAY_SIZE(sum->unknown); i++)
+            sum->unknown[i] += st->unknown[i];
+        for (i = 0; i < USB_KBD_ERR_SLOTS; i++)
+        {
+            sum->urb_status[i] += st->urb_status[i];
+            sum->resubmit[i] += st->resubmit[i];
+            sum->led_status[i] += st->led_status[i];
+        }
+        sum->mode_switches += st->mode_switches;
+    }
+}
+
+/* Per-CPU because the backoff work drops reports from process context too */
+static unsigned long usb_kbd_reports_dropped(struct usb_kbd *kbd)
+{
+    unsigned long dropped = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        dropped += READ_ONCE(per_cpu_ptr(kbd->stats, cpu)->reports_dropped);
+    return dropped;
+}
+
+static u32 usb_kbd_slots_delta(const u32 *now, const u32 *last, unsigned int n)
+{
+    u32 delta = 0;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        delta += now[i] - last[i];
+    return delta;
+}
+
+/* Print one line summarizing what the counters picked up since the last one */
+static void usb_kbd_diag_work(struct work_struct *work)
+{
+    struct usb_kbd *kbd = container_of(work, struct usb_kbd, diag_work.work);
+    struct usb_kbd_stats *now = kmalloc(sizeof(*now), GFP_KERNEL);
+    struct usb_kbd_stats *last = &kbd->diag_last;
+    u32 unknown, top = 0;
+    int i;
+
+    WRITE_ONCE(kbd->diag_next, jiffies + READ_ONCE(diag_interval_s) * HZ);
+    if (!now)
+        return;
+
+    usb_kbd_stats_sum(kbd, now);
+    for (i = 0; i < ARRAY_SIZE(now->unknown); i++)
+        if (now->unknown[i] - last->unknown[i] > now->unknown[top] - last->unknown[top])
+            top = i;
+    unknown = usb_kbd_slots_delta(now->unknown, last->unknown, ARRAY_SIZE(now->unknown));
+
+    hid_info(kbd->usbdev, "%u unknown scancodes (mostly %#x), %u URB errors, %u resubmit failures, "
+             "%u LED errors, %u mode switches\n",
+             unknown, top,
+             usb_kbd_slots_delta(now->urb_status, last->urb_status, USB_KBD_ERR_SLOTS),
+             usb_kbd_slots_delta(now->resubmit, last->resubmit, USB_KBD_ERR_SLOTS),
+             usb_kbd_slots_delta(now->led_status, last->led_status, USB_KBD_ERR_SLOTS),
+             now->mode_switches - last->mode_switches);
+
+    *last = *now;
+    kfree(now);
+}
+
+/*
+ * A counter was bumped: make sure a summary goes out, but no sooner than
+ * diag_interval_s after the previous one.  Safe from any context.
+ */
+static void usb_kbd_diag_note(struct usb_kbd *kbd)
+{
+    long delay = READ_ONCE(kbd->diag_next) - jiffies;
+
+    if (!delayed_work_pending(&kbd->diag_work))
+        schedule_delayed_work(&kbd->diag_work, delay > 0 ? delay : 0);
+}
+
+/*
+ * An interrupt URB completed with an error.  Resubmitting straight from
+ * the completion handler lets a babbling or half-attached device keep a
+ * CPU busy, so park the URB and retry after a delay that doubles with
+ * every consecutive error; a device that keeps failing gets reset.
+ */
+static void usb_kbd_urb_error(struct usb_kbd *kbd, struct urb *urb)
+{
+    unsigned int limit = READ_ONCE(reset_after_errors);
+    unsigned long flags;
+    unsigned int slot, shift;
+
+    for (slot = 0; slot < kbd->nr_urbs && kbd->irq[slot] != urb; slot++)
+        ;
+
+    spin_lock_irqsave(&kbd->health_lock, flags);
+    kbd->error_streak++;
+    if (!kbd->io_running || kbd->resetting)
+    {
+        /* Being stopped or reset; the URB stays idle */
+    }
+    else if (limit && kbd->error_streak >= limit)
+    {
+        kbd->resetting = true;
+        kbd->resets++;
+        usb_queue_reset_device(kbd->intf);
+    }
+    else
+    {
+        __set_bit(slot, &kbd->parked);
+        if (!kbd->backoff_pending)
+        {
+            shift = min(kbd->error_streak - 1, (unsigned int)ilog2(USB_KBD_BACKOFF_MAX_MS));
+            kbd->backoff_pending = true;
+            kbd->backoffs++;
+            schedule_delayed_work(&kbd->backoff_work, msecs_to_jiffies(1U << shift));
+        }
+    }
+    spin_unlock_irqrestore(&kbd->health_lock, flags);
+}
+
+static void usb_kbd_urb_ok(struct usb_kbd *kbd)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&kbd->health_lock, flags);
+    kbd->error_streak = 0;
+    spin_unlock_irqrestore(&kbd->health_lock, flags);
+}
+
+static void usb_kbd_backoff_work(struct work_struct *work)
+{
+    struct usb_kbd *kbd = container_of(work, struct usb_kbd, backoff_work.work);
+    unsigned long flags, parked;
+    int i, error;
+
+    spin_lock_irqsave(&kbd->health_lock, flags);
+    parked = kbd->io_running ? kbd->parked : 0;
+    kbd->parked = 0;
+    kbd->backoff_pending = false;
+    spin_unlock_irqrestore(&kbd->health_lock, flags);
+
+    for_each_set_bit(i, &parked, kbd->nr_urbs)
+    {
+        error = usb_submit_urb(kbd->irq[i], GFP_KERNEL);
+        if (error)
+        {
+            this_cpu_inc(kbd->stats->reports_dropped);
+            this_cpu_inc(kbd->stats->resubmit[usb_kbd_err_slot(error)]);
+            usb_kbd_diag_note(kbd);
+        }
+    }
+}
+
+static void usb_kbd_kill_irq_urbs(struct usb_kbd *kbd)
+{
+    int i;
+
+    for (i = 0; i < kbd->nr_urbs; i++)
+        usb_kill_urb(kbd->irq[i]);
+}
+
+static void usb_kbd_free_irq_urbs(struct usb_kbd *kbd)
+{
+    int i;
+
+    for (i = 0; i < kbd->nr_urbs; i++)
+        usb_free_urb(kbd->irq[i]);
+}
+
+/* Stop the interrupt ring, including URBs parked for backoff.  Called with io_mutex held. */
+static void usb_kbd_stop_io(struct usb_kbd *kbd)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&kbd->health_lock, flags);
+    kbd->io_running = false;
+    spin_unlock_irqrestore(&kbd->health_lock, flags);
+
+    cancel_delayed_work_sync(&kbd->backoff_work);
+    usb_kbd_kill_irq_urbs(kbd);
+    /* Deliver what the ring still holds */
+    if (kbd->queue)
+        flush_work(&kbd->report_work);
+}
+
+/* Called with io_mutex held */
+static usb_complete_t usb_kbd_irq_handler(const struct usb_kbd *kbd);
+
+static int usb_kbd_start_io(struct usb_kbd *kbd)
+{
+    usb_complete_t complete = usb_kbd_irq_handler(kbd);
+    unsigned long flags;
+    int i;
+
+    spin_lock_irqsave(&kbd->health_lock, flags);
+    kbd->io_running = true;
+    kbd->parked = 0;
+    kbd->backoff_pending = false;
+    spin_unlock_irqrestore(&kbd->health_lock, flags);
+
+    for (i = 0; i < kbd->nr_irq; i++)
+        kbd->irq[i]->complete = complete;
+    for (i = 0; i < kbd->nr_urbs; i++)
+    {
+        kbd->irq[i]->dev = kbd->usbdev;
+        if (usb_submit_urb(kbd->irq[i], GFP_KERNEL))
+        {
+            usb_kbd_stop_io(kbd);
+            return -EIO;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Encode a polling interval in microseconds as bInterval for the speed
+ * the device runs at, rounding down to what the bus can schedule: whole
+ * 1 ms frames at full and low speed (10 ms minimum at low speed), or
+ * 2^(bInterval-1) microframes of 125 us at high speed and above.
+ */
+static int usb_kbd_encode_interval(struct usb_device *udev, unsigned int us)
+{
+    switch (udev->speed)
+    {
+    case USB_SPEED_LOW:
+        if (us < 10000 || us > 255000)
+            return -EINVAL;
+        return us / 1000;
+    case USB_SPEED_FULL:
+        if (us < 1000 || us > 255000)
+            return -EINVAL;
+        return us / 1000;
+    default:
+        if (us < 125 || us > (125U << 15))
+            return -EINVAL;
+        return ilog2(us / 125) + 1;
+    }
+}
+
+static unsigned int usb_kbd_interval_us(struct usb_device *udev, u8 binterval)
+{
+    if (udev->speed >= USB_SPEED_HIGH)
+        return 125U << (binterval - 1);
+    return binterval * 1000U;
+}
+
+/*
+ * Poll the interrupt endpoint every bInterval.  xHCI takes the interval
+ * from the endpoint descriptor when the endpoint is enabled and ignores
+ * urb->interval, so the descriptor is patched and the endpoint enabled
+ * again with SET_INTERFACE; other controllers go by urb->interval, which
+ * is set the way usb_fill_int_urb() would.  The ring must be stopped.
+ */
+static int usb_kbd_set_interval(struct usb_kbd *kbd, u8 binterval)
+{
+    struct usb_host_interface *alt = kbd->intf->cur_altsetting;
+    u8 old = kbd->endpoint->bInterval;
+    int error, i;
+
+    if (binterval == old)
+        return 0;
+
+    kbd->endpoint->bInterval = binterval;
+    error = usb_set_interface(kbd->usbdev, alt->desc.bInterfaceNumber, alt->desc.bAlternateSetting);
+    if (error)
+    {
+        /* Typically -ENOSPC, not enough periodic bandwidth left; keep what worked */
+        kbd->endpoint->bInterval = old;
+        usb_set_interface(kbd->usbdev, alt->desc.bInterfaceNumber, alt->desc.bAlternateSetting);
+        return error;
+    }
+
+    for (i = 0; i < kbd->nr_irq; i++)
+        kbd->irq[i]->interval = kbd->usbdev->speed >= USB_SPEED_HIGH ? 1 << (binterval - 1) : binterval;
+    return 0;
+}
+
+/* Producer side of the capture ring, called from the completion handler only */
+static void usb_kbd_capture(struct usb_kbd *kbd, struct urb *urb, u64 ns)
+{
+    struct usb_kbd_capture_header *hdr = READ_ONCE(kbd->capture);
+    struct usb_kbd_capture_record *rec;
+    u64 head = kbd->capture_head;
+
+    if (!hdr)
+        return;
+    if (head - READ_ONCE(hdr->tail) > kbd->capture_mask)
+    {
+        WRITE_ONCE(hdr->dropped, ++kbd->capture_dropped);
+        return;
+    }
+
+    rec = (void *)hdr + PAGE_SIZE + (head & kbd->capture_mask) * sizeof(*rec);
+    rec->ns = ns;
+    rec->status = urb->status;
+    rec->len = urb->actual_length;
+    memcpy(rec->data, urb->transfer_buffer, min_t(u32, urb->actual_length, USB_KBD_CAPTURE_DATA));
+    kbd->capture_head = head + 1;
+    smp_store_release(&hdr->head, head + 1);
+}
+
+/*
+ * Feed the events of one report to the aggregate device, consuming
+ * @events.  The counts are atomics, so a report only takes the lock if
+ * it presses the first copy or releases the last copy of a key, and
+ * then one input_sync() covers all of them.  The state reported under
+ * the lock is read back from the counts, so keyboards racing on one key
+ * settle on its final count whichever of them reports last.
+ */
+static void usb_kbd_aggregate_events(struct usb_kbd *kbd, struct usb_kbd_event *events, unsigned int n,
+                                     u64 stamp)
+{
+    struct usb_kbd_aggregate *agg = usb_kbd_agg;
+    unsigned int i, changed = 0;
+    unsigned long flags;
+
+    for (i = 0; i < n; i++)
+    {
+        unsigned int code = events[i].code;
+
+        if (!code)
+            continue;
+        if (events[i].value)
+        {
+            if (test_and_set_bit(code, kbd->agg_held) || atomic_inc_return(&agg->refs[code]) != 1)
+                continue;
+        }
+        else if (!test_and_clear_bit(code, kbd->agg_held) || !atomic_dec_and_test(&agg->refs[code]))
+            continue;
+        events[changed++] = events[i];
+    }
+    if (!changed)
+        return;
+
+    spin_lock_irqsave(&agg->lock, flags);
+    input_set_timestamp(agg->dev, ns_to_ktime(stamp));
+    for (i = 0; i < changed; i++)
+        input_report_key(agg->dev, events[i].code, atomic_read(&agg->refs[events[i].code]) > 0);
+    input_sync(agg->dev);
+    spin_unlock_irqrestore(&agg->lock, flags);
+}
+
+/* Let go of everything @kbd holds in the aggregate; its ring is stopped */
+static void usb_kbd_aggregate_release(struct usb_kbd *kbd)
+{
+    struct usb_kbd_event ev = {};
+    int code;
+
+    if (!usb_kbd_agg)
+        return;
+    for_each_set_bit(code, kbd->agg_held, KEY_CNT)
+    {
+        ev.code = code;
+        usb_kbd_aggregate_events(kbd, &ev, 1, ktime_get_ns());
+    }
+}
+
+/*
+ * Completion handler variants.  Which of these a keyboard uses cannot
+ * change while its ring runs, so usb_kbd_start_io() installs the handler
+ * built for exactly that set and the others cost no branch per report.
+ * Hotkeys and the aggregate device are global rather than per keyboard
+ * and sit behind static keys instead.  The keymap needs neither: a
+ * changed map is the same array lookup as the default one.
+ */
+#define USB_KBD_IRQ_REPORT BIT(0)   /* report protocol layout, boot protocol otherwise */
+#define USB_KBD_IRQ_QUEUE BIT(1)    /* hand reports to report_work */
+#define USB_KBD_IRQ_CAPTURE BIT(2)  /* copy raw reports into the capture ring */
+#define USB_KBD_IRQ_DEBOUNCE BIT(3) /* run presses through the debounce filter */
+#define USB_KBD_IRQ_VARIANTS 16
+
+/* Decode one report and hand its events to the input core and the hotkey engine */
+static __always_inline void usb_kbd_deliver(struct usb_kbd *kbd, const u8 *data, unsigned int len,
+                                            u64 start, const unsigned int features)
+{
+    struct usb_kbd_event *events = kbd->events;
+    const struct usb_kbd_hotkey_table *hotkeys;
+    u8 padded[USB_KBD_BOOT_REPORT_LEN];
+    const u16 *keymap;
+    unsigned int n;
+    u64 elapsed;
+    int i;
+
+    /*
+     * Boot decoding always reads eight bytes.  Past actual_length the
+     * buffer still holds an older report, so a short one is zero-padded;
+     * an empty one carries nothing at all.
+     */
+    if (!(features & USB_KBD_IRQ_REPORT) && unlikely(len < USB_KBD_BOOT_REPORT_LEN))
+    {
+        if (!len)
+            return;
+        memset(padded, 0, sizeof(padded));
+        memcpy(padded, data, len);
+        data = padded;
+    }
+
+    input_set_timestamp(kbd->dev, ns_to_ktime(start));
+
+    rcu_read_lock();
+    keymap = rcu_dereference(kbd->keymap)->keycode;
+    if (features & USB_KBD_IRQ_REPORT)
+        n = usb_kbd_core_process_layout(&kbd->core, keymap, &kbd->layout, data, len, events);
+    else
+        n = usb_kbd_core_process(&kbd->core, keymap, data, events);
+    if (features & USB_KBD_IRQ_DEBOUNCE)
+        n = usb_kbd_debounce_filter(&kbd->debounce, events, n, start);
+    if (static_branch_unlikely(&usb_kbd_hotkeys_on))
+    {
+        hotkeys = rcu_dereference(usb_kbd_hotkeys);
+        if (hotkeys)
+            usb_kbd_hotkey_match(hotkeys, events, n,
+                                 kbd->core.pressed[USB_KBD_MOD_USAGE / 64] >> (USB_KBD_MOD_USAGE % 64), start);
+    }
+    rcu_read_unlock();
+    trace_usbkbd_decoded(kbd->usbdev, n, ktime_get_ns() - start);
+
+    for (i = 0; i < n; i++)
+    {
+        if (events[i].code)
+            input_report_key(kbd->dev, events[i].code, events[i].value);
+        else if (events[i].value)
+        {
+            this_cpu_inc(kbd->stats->unknown[events[i].scancode]);
+            usb_kbd_diag_note(kbd);
+        }
+    }
+
+    input_sync(kbd->dev);
+    if (static_branch_unlikely(&usb_kbd_agg_on))
+        usb_kbd_aggregate_events(kbd, events, n, start);
+    elapsed = ktime_get_ns() - start;
+    trace_usbkbd_input_sync(kbd->usbdev, n, elapsed);
+    usb_kbd_hist_add(&kbd->irq_latency, elapsed);
+}
+
+/*
+ * Decode a report from the consumer interface and send its keys on the
+ * keyboard's input device.  Runs wherever the keyboard's reports are
+ * decoded, so the two never share an input frame.
+ */
+static void usb_kbd_consumer_deliver(struct usb_kbd *kbd, const u8 *data, unsigned int len, u64 start)
+{
+    struct usb_kbd_consumer *cc = kbd->consumer;
+    const struct usb_kbd_hotkey_table *hotkeys;
+    unsigned int n, i;
+
+    n = usb_kbd_consumer_process(&cc->pressed, &cc->layout, data, len, cc->events);
+    if (!n)
+        return;
+
+    if (static_branch_unlikely(&usb_kbd_hotkeys_on))
+    {
+        rcu_read_lock();
+        hotkeys = rcu_dereference(usb_kbd_hotkeys);
+        if (hotkeys)
+            usb_kbd_hotkey_match(hotkeys, cc->events, n,
+                                 kbd->core.pressed[USB_KBD_MOD_USAGE / 64] >> (USB_KBD_MOD_USAGE % 64), start);
+        rcu_read_unlock();
+    }
+
+    input_set_timestamp(kbd->dev, ns_to_ktime(start));
+    for (i = 0; i < n; i++)
+        input_report_key(kbd->dev, cc->events[i].code, cc->events[i].value);
+    input_sync(kbd->dev);
+    if (static_branch_unlikely(&usb_kbd_agg_on))
+        usb_kbd_aggregate_events(kbd, cc->events, n, start);
+}
+
+/*
+ * Top half in report_queue mode: copy the report into the ring.  There
+ * is a single producer: the keyboard and consumer endpoints complete in
+ * the host controller's giveback, one URB at a time.
+ */
+static void usb_kbd_enqueue(struct usb_kbd *kbd, struct urb *urb, u64 start, bool consumer)
+{
+    u32 head = kbd->queue_head;
+    u32 depth = head - smp_load_acquire(&kbd->queue_tail);
+    struct usb_kbd_queued *q;
+
+    if (depth > kbd->queue_mask)
+    {
+        kbd->queue_overflows++;
+        return;
+    }
+
+    q = (struct usb_kbd_queued *)(kbd->queue + (head & kbd->queue_mask) * kbd->queue_stride);
+    q->start = start;
+    q->len = urb->actual_length;
+    q->consumer = consumer;
+    memcpy(q->data, urb->transfer_buffer, urb->actual_length);
+    smp_store_release(&kbd->queue_head, head + 1);
+    if (depth + 1 > kbd->queue_max)
+        kbd->queue_max = depth + 1;
+}
+
+/* Bottom half in report_queue mode: drain the ring */
+static void usb_kbd_report_work(struct work_struct *work)
+{
+    struct usb_kbd *kbd = container_of(work, struct usb_kbd, report_work);
+    const unsigned int features = (kbd->report_mode ? USB_KBD_IRQ_REPORT : 0) |
+                                  (kbd->debouncing ? USB_KBD_IRQ_DEBOUNCE : 0);
+    u32 tail = kbd->queue_tail, head;
+    struct usb_kbd_queued *q;
+
+    while ((head = smp_load_acquire(&kbd->queue_head)) != tail)
+    {
+        for (; tail != head; tail++)
+        {
+            q = (struct usb_kbd_queued *)(kbd->queue + (tail & kbd->queue_mask) * kbd->queue_stride);
+            if (unlikely(q->consumer))
+                usb_kbd_consumer_deliver(kbd, q->data, q->len, q->start);
+            else
+                usb_kbd_deliver(kbd, q->data, q->len, q->start, features);
+        }
+        smp_store_release(&kbd->queue_tail, tail);
+    }
+}
+
+/*
+ * Status handling shared by the completion handlers.  Returns false if
+ * the URB carries no report: it was unlinked, or it failed and has been
+ * parked by usb_kbd_urb_error().
+ */
+static bool usb_kbd_urb_status(struct usb_kbd *kbd, struct urb *urb, u64 start)
+{
+    switch (urb->status)
+    {
+    case 0: /* success */
+        break;
+    case -ECONNRESET: /* unlink */
+    case -ENOENT:
+    case -ESHUTDOWN:
+        return false;
+    default: /* error */
+        this_cpu_inc(kbd->stats->reports_dropped);
+        this_cpu_inc(kbd->stats->urb_status[usb_kbd_err_slot(urb->status)]);
+        usb_kbd_diag_note(kbd);
+        usb_kbd_urb_error(kbd, urb);
+        return false;
+    }
+
+    if (unlikely(READ_ONCE(kbd->error_streak)))
+        usb_kbd_urb_ok(kbd);
+    usb_mark_last_busy(kbd->usbdev);
+    if (unlikely(kbd->resume_ns))
+    {
+        if (start - kbd->resume_ns < USB_KBD_WAKE_WINDOW_NS)
+            usb_kbd_hist_add(&kbd->wake_to_report, start - kbd->resume_ns);
+        kbd->resume_ns = 0;
+    }
+    return true;
+}
+
+static void usb_kbd_resubmit(struct usb_kbd *kbd, struct urb *urb)
+{
+    int error = usb_submit_urb(urb, GFP_ATOMIC);
+
+    if (error)
+    {
+        /* This URB has left the ring; the others keep polling */
+        this_cpu_inc(kbd->stats->reports_dropped);
+        this_cpu_inc(kbd->stats->resubmit[usb_kbd_err_slot(error)]);
+        usb_kbd_diag_note(kbd);
+    }
+}
+
+static __always_inline void usb_kbd_irq(struct urb *urb, const unsigned int features)
+{
+    struct usb_kbd *kbd = urb->context;
+    u64 start = ktime_get_ns();
+
+    trace_usbkbd_urb_complete(kbd->usbdev, urb->status, urb->actual_length);
+    if (features & USB_KBD_IRQ_CAPTURE)
+        usb_kbd_capture(kbd, urb, start);
+
+    if (!usb_kbd_urb_status(kbd, urb, start))
+        return;
+    kbd->reports_received++;
+
+    if (features & USB_KBD_IRQ_QUEUE)
+        usb_kbd_enqueue(kbd, urb, start, false);
+    else
+        usb_kbd_deliver(kbd, urb->transfer_buffer, urb->actual_length, start, features);
+
+    usb_kbd_resubmit(kbd, urb);
+
+    if (features & USB_KBD_IRQ_QUEUE)
+    {
+        queue_work(usb_kbd_wq, &kbd->report_work);
+        usb_kbd_hist_add(&kbd->top_half, ktime_get_ns() - start);
+    }
+}
+
+#define USB_KBD_IRQ_VARIANT(features)                   \
+    static void usb_kbd_irq_##features(struct urb *urb) \
+    {                                                   \
+        usb_kbd_irq(urb, features);                     \
+    }
+
+USB_KBD_IRQ_VARIANT(0)
+USB_KBD_IRQ_VARIANT(1)
+USB_KBD_IRQ_VARIANT(2)
+USB_KBD_IRQ_VARIANT(3)
+USB_KBD_IRQ_VARIANT(4)
+USB_KBD_IRQ_VARIANT(5)
+USB_KBD_IRQ_VARIANT(6)
+USB_KBD_IRQ_VARIANT(7)
+USB_KBD_IRQ_VARIANT(8)
+USB_KBD_IRQ_VARIANT(9)
+USB_KBD_IRQ_VARIANT(10)
+USB_KBD_IRQ_VARIANT(11)
+USB_KBD_IRQ_VARIANT(12)
+USB_KBD_IRQ_VARIANT(13)
+USB_KBD_IRQ_VARIANT(14)
+USB_KBD_IRQ_VARIANT(15)
+
+static const usb_complete_t usb_kbd_irq_handlers[USB_KBD_IRQ_VARIANTS] = {
+    usb_kbd_irq_0, usb_kbd_irq_1, usb_kbd_irq_2, usb_kbd_irq_3,
+    usb_kbd_irq_4, usb_kbd_irq_5, usb_kbd_irq_6, usb_kbd_irq_7,
+    usb_kbd_irq_8, usb_kbd_irq_9, usb_kbd_irq_10, usb_kbd_irq_11,
+    usb_kbd_irq_12, usb_kbd_irq_13, usb_kbd_irq_14, usb_kbd_irq_15,
+};
+
+/* The handler for what @kbd uses right now; its ring must be stopped */
+static usb_complete_t usb_kbd_irq_handler(const struct usb_kbd *kbd)
+{
+    return usb_kbd_irq_handlers[(kbd->report_mode ? USB_KBD_IRQ_REPORT : 0) |
+                                (kbd->queue ? USB_KBD_IRQ_QUEUE : 0) |
+                                (kbd->capturing ? USB_KBD_IRQ_CAPTURE : 0) |
+                                (kbd->debouncing ? USB_KBD_IRQ_DEBOUNCE : 0)];
+}
+
+/*
+ * Completion handler of the consumer interface.  In report_queue mode
+ * its reports go through the keyboard's ring, so only report_work ever
+ * reports on the input device.  The status handling and resubmission it
+ * shares with the keyboard's handler are safe without atomics because
+ * both endpoints complete in the host controller's giveback, one URB at
+ * a time.
+ */
+static void usb_kbd_consumer_irq(struct urb *urb)
+{
+    struct usb_kbd *kbd = urb->context;
+    u64 start = ktime_get_ns();
+
+    trace_usbkbd_urb_complete(kbd->usbdev, urb->status, urb->actual_length);
+    if (!usb_kbd_urb_status(kbd, urb, start))
+        return;
+    kbd->consumer->reports++;
+
+    if (kbd->queue)
+        usb_kbd_enqueue(kbd, urb, start, true);
+    else
+        usb_kbd_consumer_deliver(kbd, urb->transfer_buffer, urb->actual_length, start);
+
+    usb_kbd_resubmit(kbd, urb);
+
+    if (kbd->queue)
+        queue_work(usb_kbd_wq, &kbd->report_work);
+}
+
+/* The built-in keymap; its keycodes are the ones usb_kbd_keycode[] produces */
+static void usb_kbd_default_keymap(struct usb_kbd_keymap *km)
+{
+    usb_kbd_core_default_keymap(km->keycode);
+    memcpy(km->keybit, usb_kbd_keybit, sizeof(km->keybit));
+}
+
+static void usb_kbd_keymap_bits(struct usb_kbd_keymap *km)
+{
+    int i;
+
+    bitmap_zero(km->keybit, KEY_CNT);
+    for (i = 0; i < USB_KBD_KEYMAP_SIZE; i++)
+        __set_bit(km->keycode[i], km->keybit);
+    __clear_bit(KEY_RESERVED, km->keybit);
+}
+
+/*
+ * Publish @new as the active keymap.  Keycodes are only ever added to
+ * keybit, so a key held across the swap can still be released with the
+ * keycode it was pressed with.  keybit belongs to the input core, hence
+ * event_lock; keymap_lock nests inside it.
+ */
+static void usb_kbd_publish_keymap(struct usb_kbd *kbd, struct usb_kbd_keymap *new)
+{
+    struct usb_kbd_keymap *old;
+
+    lockdep_assert_held(&kbd->dev->event_lock);
+    lockdep_assert_held(&kbd->keymap_lock);
+
+    bitmap_or(kbd->dev->keybit, kbd->dev->keybit, new->keybit, KEY_CNT);
+
+    old = rcu_dereference_protected(kbd->keymap, lockdep_is_held(&kbd->keymap_lock));
+    rcu_assign_pointer(kbd->keymap, new);
+    if (old)
+        kfree_rcu(old, rcu);
+}
+
+static int usb_kbd_getkeycode(struct input_dev *dev, struct input_keymap_entry *ke)
+{
+    struct usb_kbd *kbd = input_get_drvdata(dev);
+    unsigned int scancode;
+
+    if (ke->flags & INPUT_KEYMAP_BY_INDEX)
+        scancode = ke->index;
+    else if (input_scancode_to_scalar(ke, &scancode))
+        return -EINVAL;
+    if (scancode >= USB_KBD_KEYMAP_SIZE)
+        return -EINVAL;
+
+    rcu_read_lock();
+    ke->keycode = rcu_dereference(kbd->keymap)->keycode[scancode];
+    rcu_read_unlock();
+    ke->index = scancode;
+    ke->len = sizeof(scancode);
+    memcpy(ke->scancode, &scancode, sizeof(scancode));
+    return 0;
+}
+
+/*
+ * EVIOCSKEYCODE.  The input core calls this with dev->event_lock held, so
+ * it cannot allocate a private copy with GFP_KERNEL; a single entry is a
+ * u16 store that readers see whole, so the live keymap is updated in
+ * place instead.
+ */
+static int usb_kbd_setkeycode(struct input_dev *dev, const struct input_keymap_entry *ke,
+                              unsigned int *old_keycode)
+{
+    struct usb_kbd *kbd = input_get_drvdata(dev);
+    struct usb_kbd_keymap *km;
+    unsigned int scancode;
+
+    if (ke->flags & INPUT_KEYMAP_BY_INDEX)
+        scancode = ke->index;
+    else if (input_scancode_to_scalar(ke, &scancode))
+        return -EINVAL;
+    if (scancode >= USB_KBD_KEYMAP_SIZE || ke->keycode > KEY_MAX)
+        return -EINVAL;
+
+    lockdep_assert_held(&dev->event_lock);
+    spin_lock(&kbd->keymap_lock);
+    km = rcu_dereference_protected(kbd->keymap, lockdep_is_held(&kbd->keymap_lock));
+    *old_keycode = km->keycode[scancode];
+    if (ke->keycode)
+    {
+        __set_bit(ke->keycode, km->keybit);
+        __set_bit(ke->keycode, dev->keybit);
+    }
+    WRITE_ONCE(km->keycode[scancode], ke->keycode);
+    spin_unlock(&kbd->keymap_lock);
+    return 0;
+}
+
+/*
+ * sysfs "keymap": reading lists the mapped entries as "scancode keycode"
+ * lines.  Writing takes whitespace separated "scancode:keycode" pairs that
+ * are applied together in one swap.  A leading "default" or "clear" token
+ * starts from the built-in table or from an empty one instead of the
+ * current map.
+ */
+static ssize_t keymap_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+    const struct usb_kbd_keymap *km;
+    ssize_t len = 0;
+    int i;
+
+    if (!kbd)
+        return -ENODEV;
+
+    rcu_read_lock();
+    km = rcu_dereference(kbd->keymap);
+    for (i = 0; i < USB_KBD_KEYMAP_SIZE; i++)
+        if (km->keycode[i])
+            len += sysfs_emit_at(buf, len, "%#04x %u\n", i, km->keycode[i]);
+    rcu_read_unlock();
+    return len;
+}
+
+static bool usb_kbd_skip_word(const char **p, const char *word)
+{
+    size_t len = strlen(word);
+
+    if (strncmp(*p, word, len) || ((*p)[len] && !isspace((*p)[len])))
+        return false;
+    *p += len;
+    return true;
+}
+
+static ssize_t keymap_store(struct device *dev, struct device_attribute *attr,
+                            const char *buf, size_t count)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+    DECLARE_BITMAP(touched, USB_KBD_KEYMAP_SIZE);
+    const struct usb_kbd_keymap *cur;
+    struct usb_kbd_keymap *new;
+    const char *p = skip_spaces(buf);
+    unsigned long flags;
+    int i;
+
+    if (!kbd)
+        return -ENODEV;
+
+    new = kmalloc(sizeof(*new), GFP_KERNEL);
+    if (!new)
+        return -ENOMEM;
+
+    bitmap_zero(touched, USB_KBD_KEYMAP_SIZE);
+    if (usb_kbd_skip_word(&p, "default"))
+    {
+        usb_kbd_default_keymap(new);
+        bitmap_fill(touched, USB_KBD_KEYMAP_SIZE);
+    }
+    else if (usb_kbd_skip_word(&p, "clear"))
+    {
+        memset(new->keycode, 0, sizeof(new->keycode));
+        bitmap_fill(touched, USB_KBD_KEYMAP_SIZE);
+    }
+
+    while (*(p = skip_spaces(p)))
+    {
+        unsigned int scancode, keycode;
+        int consumed;
+
+        if (sscanf(p, "%i:%i%n", &scancode, &keycode, &consumed) != 2 ||
+            scancode >= USB_KBD_KEYMAP_SIZE || keycode > KEY_MAX)
+        {
+            kfree(new);
+            return -EINVAL;
+        }
+        new->keycode[scancode] = keycode;
+        __set_bit(scancode, touched);
+        p += consumed;
+    }
+
+    /* Entries not named in the write keep their current value */
+    spin_lock_irqsave(&kbd->dev->event_lock, flags);
+    spin_lock(&kbd->keymap_lock);
+    cur = rcu_dereference_protected(kbd->keymap, lockdep_is_held(&kbd->keymap_lock));
+    for_each_clear_bit(i, touched, USB_KBD_KEYMAP_SIZE)
+        new->keycode[i] = cur->keycode[i];
+    usb_kbd_keymap_bits(new);
+    usb_kbd_publish_keymap(kbd, new);
+    spin_unlock(&kbd->keymap_lock);
+    spin_unlock_irqrestore(&kbd->dev->event_lock, flags);
+
+    return count;
+}
+static DEVICE_ATTR_RW(keymap);
+
+static ssize_t reports_received_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+
+    if (!kbd)
+        return -ENODEV;
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(kbd->reports_received));
+}
+static DEVICE_ATTR_RO(reports_received);
+
+static ssize_t reports_dropped_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+
+    if (!kbd)
+        return -ENODEV;
+    return sysfs_emit(buf, "%lu\n", usb_kbd_reports_dropped(kbd));
+}
+static DEVICE_ATTR_RO(reports_dropped);
+
+static ssize_t health_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+    const char *state;
+    unsigned long flags;
+
+    if (!kbd)
+        return -ENODEV;
+
+    spin_lock_irqsave(&kbd->health_lock, flags);
+    if (kbd->resetting)
+        state = "resetting";
+    else if (kbd->backoff_pending)
+        state = "backoff";
+    else if (kbd->error_streak)
+        state = "degraded";
+    else
+        state = "healthy";
+    spin_unlock_irqrestore(&kbd->health_lock, flags);
+
+    return sysfs_emit(buf, "%s\n", state);
+}
+static DEVICE_ATTR_RO(health);
+
+static ssize_t error_streak_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+
+    if (!kbd)
+        return -ENODEV;
+    return sysfs_emit(buf, "%u\n", READ_ONCE(kbd->error_streak));
+}
+static DEVICE_ATTR_RO(error_streak);
+
+static ssize_t backoffs_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+
+    if (!kbd)
+        return -ENODEV;
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(kbd->backoffs));
+}
+static DEVICE_ATTR_RO(backoffs);
+
+static ssize_t resets_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+
+    if (!kbd)
+        return -ENODEV;
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(kbd->resets));
+}
+static DEVICE_ATTR_RO(resets);
+
+static int usb_kbd_capture_alloc(struct usb_kbd *kbd)
+{
+    unsigned int n = roundup_pow_of_two(clamp_val(READ_ONCE(capture_records), 64, 1 << 20));
+    struct usb_kbd_capture_header *hdr;
+
+    lockdep_assert_held(&kbd->io_mutex);
+    if (kbd->capture)
+        return 0;
+
+    hdr = vmalloc_user(PAGE_SIZE + PAGE_ALIGN(n * sizeof(struct usb_kbd_capture_record)));
+    if (!hdr)
+        return -ENOMEM;
+    hdr->magic = USB_KBD_CAPTURE_MAGIC;
+    hdr->version = USB_KBD_CAPTURE_VERSION;
+    hdr->nr_records = n;
+    hdr->record_size = sizeof(struct usb_kbd_capture_record);
+    hdr->records_offset = PAGE_SIZE;
+    hdr->report_mode = kbd->report_mode;
+    hdr->report_len = kbd->report_mode ? kbd->layout.report_len : USB_KBD_BOOT_REPORT_LEN;
+    kbd->capture_mask = n - 1;
+    smp_store_release(&kbd->capture, hdr);
+    return 0;
+}
+
+static ssize_t capture_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+
+    if (!kbd)
+        return -ENODEV;
+    return sysfs_emit(buf, "%d\n", READ_ONCE(kbd->capturing));
+}
+
+static ssize_t capture_store(struct device *dev, struct device_attribute *attr,
+                             const char *buf, size_t count)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+    bool enable;
+    int error;
+
+    if (!kbd)
+        return -ENODEV;
+
+    error = kstrtobool(buf, &enable);
+    if (error)
+        return error;
+
+    /* Outside io_mutex: resume takes it */
+    error = usb_autopm_get_interface(kbd->intf);
+    if (error)
+        return error;
+
+    mutex_lock(&kbd->io_mutex);
+    error = enable ? usb_kbd_capture_alloc(kbd) : 0;
+    if (!error && enable != kbd->capturing)
+    {
+        /* Restart the ring with the handler that copies, or does not */
+        if (kbd->opened)
+            usb_kbd_stop_io(kbd);
+        WRITE_ONCE(kbd->capturing, enable);
+        if (kbd->opened && usb_kbd_start_io(kbd))
+        {
+            kbd->opened = false;
+            error = -EIO;
+        }
+    }
+    mutex_unlock(&kbd->io_mutex);
+
+    usb_autopm_put_interface(kbd->intf);
+    return error ? error : count;
+}
+static DEVICE_ATTR_RW(capture);
+
+static ssize_t poll_interval_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+
+    if (!kbd)
+        return -ENODEV;
+    return sysfs_emit(buf, "%u\n", usb_kbd_interval_us(kbd->usbdev, READ_ONCE(kbd->endpoint->bInterval)));
+}
+
+/* 0 goes back to the descriptor's interval; others are rounded down to the bus */
+static ssize_t poll_interval_us_store(struct device *dev, struct device_attribute *attr,
+                                      const char *buf, size_t count)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+    unsigned int us;
+    int binterval, error;
+
+    if (!kbd)
+        return -ENODEV;
+
+    error = kstrtouint(buf, 0, &us);
+    if (error)
+        return error;
+    binterval = us ? usb_kbd_encode_interval(kbd->usbdev, us) : kbd->desc_interval;
+    if (binterval < 0)
+        return binterval;
+
+    /* Outside io_mutex: resume takes it */
+    error = usb_autopm_get_interface(kbd->intf);
+    if (error)
+        return error;
+
+    mutex_lock(&kbd->io_mutex);
+    if (kbd->opened)
+        usb_kbd_stop_io(kbd);
+    error = usb_kbd_set_interval(kbd, binterval);
+    if (kbd->opened && usb_kbd_start_io(kbd))
+    {
+        kbd->opened = false;
+        error = -EIO;
+    }
+    mutex_unlock(&kbd->io_mutex);
+
+    usb_autopm_put_interface(kbd->intf);
+    return error ? error : count;
+}
+static DEVICE_ATTR_RW(poll_interval_us);
+
+/*
+ * sysfs "debounce": reading lists the keys with a window as "scancode ms"
+ * lines.  Writing takes whitespace separated "scancode:ms" pairs, or
+ * "all:ms" for every key; ms is at most 255, 0 turns filtering off.
+ */
+static ssize_t debounce_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+    ssize_t len = 0;
+    u8 ms;
+    int i;
+
+    if (!kbd)
+        return -ENODEV;
+
+    for (i = 0; i < USB_KBD_KEYMAP_SIZE; i++)
+    {
+        ms = READ_ONCE(kbd->debounce.window_ms[i]);
+        if (ms)
+            len += sysfs_emit_at(buf, len, "%#04x %u\n", i, ms);
+    }
+    return len;
+}
+
+static ssize_t debounce_store(struct device *dev, struct device_attribute *attr,
+                              const char *buf, size_t count)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+    DECLARE_BITMAP(touched, USB_KBD_KEYMAP_SIZE);
+    u8 windows[USB_KBD_KEYMAP_SIZE];
+    const char *p = buf;
+    unsigned long flags;
+    bool any = false;
+    int i, error;
+
+    if (!kbd)
+        return -ENODEV;
+
+    bitmap_zero(touched, USB_KBD_KEYMAP_SIZE);
+    while (*(p = skip_spaces(p)))
+    {
+        unsigned int scancode, ms;
+        int consumed;
+
+        if (sscanf(p, "all:%u%n", &ms, &consumed) == 1 && ms <= U8_MAX)
+        {
+            memset(windows, ms, sizeof(windows));
+            bitmap_fill(touched, USB_KBD_KEYMAP_SIZE);
+        }
+        else if (sscanf(p, "%i:%u%n", &scancode, &ms, &consumed) == 2 &&
+                 scancode < USB_KBD_KEYMAP_SIZE && ms <= U8_MAX)
+        {
+            windows[scancode] = ms;
+            __set_bit(scancode, touched);
+        }
+        else
+            return -EINVAL;
+        p += consumed;
+    }
+
+    /* Outside io_mutex: resume takes it */
+    error = usb_autopm_get_interface(kbd->intf);
+    if (error)
+        return error;
+
+    mutex_lock(&kbd->io_mutex);
+    /* Keys not named in the write keep their window */
+    spin_lock_irqsave(&kbd->keymap_lock, flags);
+    for (i = 0; i < USB_KBD_KEYMAP_SIZE; i++)
+    {
+        if (test_bit(i, touched))
+            WRITE_ONCE(kbd->debounce.window_ms[i], windows[i]);
+        any |= kbd->debounce.window_ms[i] != 0;
+    }
+    spin_unlock_irqrestore(&kbd->keymap_lock, flags);
+
+    if (any != kbd->debouncing)
+    {
+        /* Restart the ring with the handler that filters, or does not */
+        if (kbd->opened)
+            usb_kbd_stop_io(kbd);
+        WRITE_ONCE(kbd->debouncing, any);
+        if (kbd->opened && usb_kbd_start_io(kbd))
+        {
+            kbd->opened = false;
+            error = -EIO;
+        }
+    }
+    mutex_unlock(&kbd->io_mutex);
+
+    usb_autopm_put_interface(kbd->intf);
+    return error ? error : count;
+}
+static DEVICE_ATTR_RW(debounce);
+
+/* Presses swallowed by the debounce filter, as "scancode count" lines */
+static ssize_t chatter_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+    ssize_t len = 0;
+    u32 n;
+    int i;
+
+    if (!kbd)
+        return -ENODEV;
+
+    for (i = 0; i < USB_KBD_KEYMAP_SIZE; i++)
+    {
+        n = READ_ONCE(kbd->debounce.chatter[i]);
+        if (n)
+            len += sysfs_emit_at(buf, len, "%#04x %u\n", i, n);
+    }
+    return len;
+}
+static DEVICE_ATTR_RO(chatter);
+
+/*
+ * sysfs "led_policy": reading prints one line per mode and LED code, each
+ * with the 32 entries for the LED states as "out:next".  Writing takes
+ * whitespace separated "mode:led:state:out:next" rules applied in order
+ * on top of the current policy, or of the built-in or pass-through one
+ * after a leading "default" or "clear".  State is "match/mask", a plain
+ * value, or "*" for any; out is a value, "*" for the LED state as is or
+ * "+bits" for the state with those bits set; mode, led and next take "*"
+ * for all modes, all LEDs and stay.
+ */
+static ssize_t led_policy_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+    const struct usb_kbd_led_policy *policy;
+    ssize_t len = 0;
+    int m, c, s;
+
+    if (!kbd)
+        return -ENODEV;
+
+    rcu_read_lock();
+    policy = &rcu_dereference(kbd->led_rules)->policy;
+    for (m = 0; m < USB_KBD_LED_MODES; m++)
+        for (c = 0; c < USB_KBD_LED_CODES; c++)
+        {
+            len += sysfs_emit_at(buf, len, "%d %d", m, c);
+            for (s = 0; s < USB_KBD_LED_STATES; s++)
+                len += sysfs_emit_at(buf, len, " %02x:%u", policy->entry[m][c][s].out,
+                                     policy->entry[m][c][s].next);
+            len += sysfs_emit_at(buf, len, "\n");
+        }
+    rcu_read_unlock();
+    return len;
+}
+
+/* One field of a led_policy rule: a number up to @max, or "*" for -1 */
+static int usb_kbd_led_field(char **rule, int max, int *val)
+{
+    char *f = strsep(rule, ":");
+
+    if (!f)
+        return -EINVAL;
+    if (!strcmp(f, "*"))
+    {
+        *val = -1;
+        return 0;
+    }
+    if (kstrtoint(f, 0, val) || *val < 0 || *val > max)
+        return -EINVAL;
+    return 0;
+}
+
+static int usb_kbd_led_rule(struct usb_kbd_led_policy *policy, char *rule)
+{
+    unsigned int match = 0, mask = 0, or_bits = 0;
+    int mode, code, out, next;
+    char *state, *f;
+
+    if (usb_kbd_led_field(&rule, USB_KBD_LED_MODES - 1, &mode) ||
+        usb_kbd_led_field(&rule, USB_KBD_LED_CODES - 1, &code))
+        return -EINVAL;
+
+    state = strsep(&rule, ":");
+    if (!state)
+        return -EINVAL;
+    if (strcmp(state, "*"))
+    {
+        mask = USB_KBD_LED_STATES - 1;
+        if (sscanf(state, "%i/%i", &match, &mask) < 1 || match >= USB_KBD_LED_STATES ||
+            mask >= USB_KBD_LED_STATES || (match & ~mask))
+            return -EINVAL;
+    }
+
+    f = strsep(&rule, ":");
+    if (!f)
+        return -EINVAL;
+    if (*f == '+')
+    {
+        out = -1;
+        if (kstrtouint(f + 1, 0, &or_bits) || or_bits > U8_MAX)
+            return -EINVAL;
+    }
+    else if (!strcmp(f, "*"))
+        out = -1;
+    else if (kstrtoint(f, 0, &out) || out < 0 || out > U8_MAX)
+        return -EINVAL;
+
+    if (usb_kbd_led_field(&rule, USB_KBD_LED_MODES - 1, &next) || rule)
+        return -EINVAL;
+
+    usb_kbd_led_policy_set(policy, mode, code, match, mask, out, or_bits, next);
+    return 0;
+}
+
+static ssize_t led_policy_store(struct device *dev, struct device_attribute *attr,
+                                const char *buf, size_t count)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(to_usb_interface(dev));
+    struct usb_kbd_led_rules *new, *old;
+    char *copy, *p, *rule;
+    bool first = true;
+    int error = 0;
+
+    if (!kbd)
+        return -ENODEV;
+
+    new = kmalloc(sizeof(*new), GFP_KERNEL);
+    copy = kstrndup(buf, count, GFP_KERNEL);
+    if (!new || !copy)
+    {
+        error = -ENOMEM;
+        goto out;
+    }
+
+    mutex_lock(&kbd->led_rules_mutex);
+    old = rcu_dereference_protected(kbd->led_rules, lockdep_is_held(&kbd->led_rules_mutex));
+    new->policy = old->policy;
+    p = copy;
+    while ((rule = strsep(&p, " \t\n")))
+    {
+        if (!*rule)
+            continue;
+        if (first && !strcmp(rule, "default"))
+            usb_kbd_led_policy_default(&new->policy);
+        else if (first && !strcmp(rule, "clear"))
+            usb_kbd_led_policy_clear(&new->policy);
+        else if (usb_kbd_led_rule(&new->policy, rule))
+        {
+            error = -EINVAL;
+            break;
+        }
+        first = false;
+    }
+    if (!error)
+    {
+        rcu_assign_pointer(kbd->led_rules, new);
+        new = NULL;
+    }
+    mutex_unlock(&kbd->led_rules_mutex);
+    if (!error)
+        kfree_rcu(old, rcu);
+
+out:
+    kfree(copy);
+    kfree(new);
+    return error ?: count;
+}
+static DEVICE_ATTR_RW(led_policy);
+
+/*
+ * Disconnect clears intfdata before the driver core takes these away, so
+ * each handler returns -ENODEV once it is gone.  The core drains running
+ * handlers before usb_kbd_disconnect() frees anything.
+ */
+static struct attribute *usb_kbd_attrs[] = {
+    &dev_attr_keymap.attr,
+    &dev_attr_led_policy.attr,
+    &dev_attr_reports_received.attr,
+    &dev_attr_reports_dropped.attr,
+    &dev_attr_health.attr,
+    &dev_attr_error_streak.attr,
+    &dev_attr_backoffs.attr,
+    &dev_attr_resets.attr,
+    &dev_attr_capture.attr,
+    &dev_attr_poll_interval_us.attr,
+    &dev_attr_debounce.attr,
+    &dev_attr_chatter.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(usb_kbd);
+
+static void usb_kbd_hist_show(struct seq_file *m, const char *name, const struct usb_kbd_hist *h)
+{
+    int i;
+
+    seq_printf(m, "%s: count %llu mean %lluns max %lluns p50<=%lluns p90<=%lluns p99<=%lluns\n",
+               name, h->count, h->count ? div64_u64(h->sum, h->count) : 0, h->max,
+               usb_kbd_hist_percentile(h, 50), usb_kbd_hist_percentile(h, 90),
+               usb_kbd_hist_percentile(h, 99));
+    for (i = 0; i < USB_KBD_HIST_BUCKETS; i++)
+        if (h->buckets[i])
+            seq_printf(m, "  < %12lluns %llu\n", 2ULL << i, h->buckets[i]);
+}
+
+static int usb_kbd_latency_show(struct seq_file *m, void *unused)
+{
+    struct usb_kbd *kbd = m->private;
+
+    usb_kbd_hist_show(m, "complete_to_sync", &kbd->irq_latency);
+    usb_kbd_hist_show(m, "led_event_to_ack", &kbd->led_latency);
+    usb_kbd_hist_show(m, "wake_to_report", &kbd->wake_to_report);
+    usb_kbd_hist_show(m, "suspended_for", &kbd->suspended_for);
+    if (kbd->queue)
+        usb_kbd_hist_show(m, "top_half", &kbd->top_half);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(usb_kbd_latency);
+
+static void usb_kbd_slots_show(struct seq_file *m, const char *name, const u32 *slots)
+{
+    int i;
+
+    for (i = 0; i < USB_KBD_ERR_SLOTS; i++)
+        if (slots[i])
+        {
+            if (i)
+                seq_printf(m, "%s %d %u\n", name, -usb_kbd_errnos[i], slots[i]);
+            else
+                seq_printf(m, "%s other %u\n", name, slots[i]);
+        }
+}
+
+static int usb_kbd_counters_show(struct seq_file *m, void *unused)
+{
+    struct usb_kbd *kbd = m->private;
+    struct usb_kbd_stats *sum;
+    int i;
+
+    sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+    if (!sum)
+        return -ENOMEM;
+
+    usb_kbd_stats_sum(kbd, sum);
+    for (i = 0; i < ARRAY_SIZE(sum->unknown); i++)
+        if (sum->unknown[i])
+            seq_printf(m, "unknown_scancode %#04x %u\n", i, sum->unknown[i]);
+    usb_kbd_slots_show(m, "urb_status", sum->urb_status);
+    usb_kbd_slots_show(m, "resubmit_error", sum->resubmit);
+    usb_kbd_slots_show(m, "led_error", sum->led_status);
+    seq_printf(m, "mode_switches %u\n", sum->mode_switches);
+    seq_printf(m, "led_mode %u\n", READ_ONCE(kbd->led_mode));
+    seq_printf(m, "irq_handler %s%s%s%s\n", kbd->report_mode ? "report" : "boot", kbd->queue ? "+queue" : "",
+               READ_ONCE(kbd->capturing) ? "+capture" : "", READ_ONCE(kbd->debouncing) ? "+debounce" : "");
+    if (kbd->consumer)
+        seq_printf(m, "consumer_reports %lu\n", READ_ONCE(kbd->consumer->reports));
+    if (kbd->queue)
+    {
+        seq_printf(m, "queue_depth %u\n", READ_ONCE(kbd->queue_head) - READ_ONCE(kbd->queue_tail));
+        seq_printf(m, "queue_max_depth %u\n", READ_ONCE(kbd->queue_max));
+        seq_printf(m, "queue_overflows %lu\n", READ_ONCE(kbd->queue_overflows));
+    }
+
+    kfree(sum);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(usb_kbd_counters);
+
+/*
+ * Effective report rate over one second of reading, with the time spent
+ * in the completion handler over the same second.  Keyboards only send
+ * when something changes, so hold keys or use kbd_gadget to see the
+ * polling rate itself.
+ */
+static int usb_kbd_rate_show(struct seq_file *m, void *unused)
+{
+    struct usb_kbd *kbd = m->private;
+    unsigned long reports;
+    u64 handler_ns, top_half_ns, t;
+
+    reports = READ_ONCE(kbd->reports_received) + usb_kbd_reports_dropped(kbd);
+    handler_ns = READ_ONCE(kbd->irq_latency.sum);
+    top_half_ns = READ_ONCE(kbd->top_half.sum);
+    t = ktime_get_ns();
+    if (msleep_interruptible(1000))
+        return -EINTR;
+    reports = READ_ONCE(kbd->reports_received) + usb_kbd_reports_dropped(kbd) - reports;
+    handler_ns = READ_ONCE(kbd->irq_latency.sum) - handler_ns;
+    top_half_ns = READ_ONCE(kbd->top_half.sum) - top_half_ns;
+    t = ktime_get_ns() - t;
+
+    seq_printf(m, "interval %uus %s-speed\n",
+               usb_kbd_interval_us(kbd->usbdev, READ_ONCE(kbd->endpoint->bInterval)),
+               usb_speed_string(kbd->usbdev->speed));
+    seq_printf(m, "reports_per_s %llu\n", div64_u64((u64)reports * NSEC_PER_SEC, t));
+    seq_printf(m, "handler_ns_per_s %llu\n", div64_u64(handler_ns * NSEC_PER_SEC, t));
+    if (kbd->queue)
+        seq_printf(m, "top_half_ns_per_s %llu\n", div64_u64(top_half_ns * NSEC_PER_SEC, t));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(usb_kbd_rate);
+
+/*
+ * Map the capture ring; enable capture through sysfs first.  debugfs'
+ * proxy fops have no ->mmap, so the file is created unsafe and guards
+ * itself: an open file outlives disconnect, and debugfs_file_get() fails
+ * once the file is removed and holds off the removal, and the kfree() of
+ * @kbd behind it, while the mapping is set up.  The mapping takes its own
+ * reference on every page, so the ring stays valid after disconnect's
+ * vfree() until the reader unmaps it.
+ */
+static int usb_kbd_capture_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct usb_kbd *kbd = file->private_data;
+    struct usb_kbd_capture_header *hdr;
+    int error;
+
+    error = debugfs_file_get(file->f_path.dentry);
+    if (error)
+        return error;
+
+    hdr = smp_load_acquire(&kbd->capture);
+    error = hdr ? remap_vmalloc_range(vma, hdr, vma->vm_pgoff) : -ENODATA;
+    debugfs_file_put(file->f_path.dentry);
+    return error;
+}
+
+static const struct file_operations usb_kbd_capture_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .mmap = usb_kbd_capture_mmap,
+};
+
+/*
+ * Send kbd->newleds if it differs from what the device last got.  Only
+ * one control transfer is in flight at a time; whatever state is latest
+ * when it completes is sent next, so intermediate states are coalesced
+ * and the final one is never lost.  Called with leds_lock held.
+ */
+static void usb_kbd_led_kick(struct usb_kbd *kbd)
+{
+    unsigned long interval, elapsed;
+    int error;
+
+    if (kbd->led_urb_submitted || (kbd->newleds == *kbd->leds && !kbd->led_resend))
+        return;
+
+    if (kbd->suspended)
+    {
+        /* Wake the device up; resume sends the LEDs and drops the reference */
+        if (!kbd->led_wakeup)
+            kbd->led_wakeup = !usb_autopm_get_interface_async(kbd->intf);
+        return;
+    }
+
+    /* Elapsed time, not a deadline: a long idle cannot wrap it into the future */
+    interval = msecs_to_jiffies(READ_ONCE(led_interval_ms));
+    elapsed = jiffies - kbd->led_last;
+    if (elapsed < interval)
+    {
+        schedule_delayed_work(&kbd->led_work, interval - elapsed);
+        return;
+    }
+
+    *kbd->leds = kbd->newleds;
+    trace_usbkbd_led_submit(kbd->usbdev, *kbd->leds);
+    kbd->led_last = jiffies;
+    kbd->led_resend = false;
+    kbd->led_urb_submitted = true;
+    error = usb_submit_urb(kbd->led, GFP_ATOMIC);
+    if (error)
+    {
+        /* Resend on the next LED event rather than spinning here */
+        kbd->led_urb_submitted = false;
+        kbd->led_resend = true;
+        this_cpu_inc(kbd->stats->led_status[usb_kbd_err_slot(error)]);
+        usb_kbd_diag_note(kbd);
+    }
+}
+
+static void usb_kbd_led_work(struct work_struct *work)
+{
+    struct usb_kbd *kbd = container_of(work, struct usb_kbd, led_work.work);
+    unsigned long flags;
+
+    spin_lock_irqsave(&kbd->leds_lock, flags);
+    usb_kbd_led_kick(kbd);
+    spin_unlock_irqrestore(&kbd->leds_lock, flags);
+}
+
+/*
+ * The input core calls this under its event_lock, which also covers
+ * led_mode, so the policy lookup runs without leds_lock.  Only handing
+ * the result to the LED pipeline takes it.
+ */
+static int usb_kbd_event(struct input_dev *dev, unsigned int type, unsigned int code, int value)
+{
+    struct usb_kbd *kbd = input_get_drvdata(dev);
+    struct usb_kbd_led_entry e;
+    unsigned long flags;
+
+    if (type != EV_LED)
+        return -1;
+    if (code >= USB_KBD_LED_CODES)
+        return 0;
+
+    rcu_read_lock();
+    e = rcu_dereference(kbd->led_rules)->policy.entry[kbd->led_mode][code][dev->led[0] & (USB_KBD_LED_STATES - 1)];
+    rcu_read_unlock();
+    if (e.next != kbd->led_mode)
+    {
+        kbd->led_mode = e.next;
+        this_cpu_inc(kbd->stats->mode_switches);
+    }
+
+    spin_lock_irqsave(&kbd->leds_lock, flags);
+    kbd->newleds = e.out;
+    if (!kbd->led_event_ns && kbd->newleds != *kbd->leds)
+        kbd->led_event_ns = ktime_get_ns();
+    usb_kbd_led_kick(kbd);
+    spin_unlock_irqrestore(&kbd->leds_lock, flags);
+    return 0;
+}
+
+static void usb_kbd_led(struct urb *urb)
+{
+    unsigned long flags;
+    struct usb_kbd *kbd = urb->context;
+
+    trace_usbkbd_led_complete(urb->dev, urb->status, urb->actual_length);
+
+    spin_lock_irqsave(&kbd->leds_lock, flags);
+    kbd->led_urb_submitted = false;
+
+    switch (urb->status)
+    {
+    case 0: /* success */
+        if (kbd->led_event_ns && kbd->newleds == *kbd->leds)
+        {
+            usb_kbd_hist_add(&kbd->led_latency, ktime_get_ns() - kbd->led_event_ns);
+            kbd->led_event_ns = 0;
+        }
+        usb_kbd_led_kick(kbd);
+        break;
+    case -ECONNRESET: /* unlink */
+    case -ENOENT:
+    case -ESHUTDOWN:
+        kbd->led_resend = true;
+        break;
+    default: /* error */
+        this_cpu_inc(kbd->stats->led_status[usb_kbd_err_slot(urb->status)]);
+        usb_kbd_diag_note(kbd);
+        /* Retry the latest state, no faster than USB_KBD_LED_RETRY_MS */
+        kbd->led_resend = true;
+        schedule_delayed_work(&kbd->led_work,
+                              msecs_to_jiffies(max(READ_ONCE(led_interval_ms), USB_KBD_LED_RETRY_MS)));
+        break;
+    }
+    spin_unlock_irqrestore(&kbd->leds_lock, flags);
+}
+
+/*
+ * The ring runs while anyone uses the keyboard: its own input device or
+ * the aggregate one.  The first user starts it, the last stops it.
+ */
+static int usb_kbd_get_io(struct usb_kbd *kbd)
+{
+    int error;
+
+    /* Outside io_mutex: resume takes it */
+    error = usb_autopm_get_interface(kbd->intf);
+    if (error)
+        return error;
+
+    mutex_lock(&kbd->io_mutex);
+    if (!kbd->users)
+    {
+        /* The input core released every key on close; start from a clean slate */
+        usb_kbd_core_init(&kbd->core);
+        usb_kbd_debounce_reset(&kbd->debounce);
+        if (kbd->consumer)
+            kbd->consumer->pressed = 0;
+        error = usb_kbd_start_io(kbd);
+        kbd->opened = !error;
+        kbd->intf->needs_remote_wakeup = !error;
+    }
+    if (!error)
+        kbd->users++;
+    mutex_unlock(&kbd->io_mutex);
+
+    usb_autopm_put_interface(kbd->intf);
+    return error;
+}
+
+static void usb_kbd_put_io(struct usb_kbd *kbd)
+{
+    mutex_lock(&kbd->io_mutex);
+    if (!--kbd->users)
+    {
+        kbd->opened = false;
+        kbd->intf->needs_remote_wakeup = 0;
+        usb_kbd_stop_io(kbd);
+        usb_kbd_aggregate_release(kbd);
+    }
+    mutex_unlock(&kbd->io_mutex);
+}
+
+static int usb_kbd_open(struct input_dev *dev)
+{
+    return usb_kbd_get_io(input_get_drvdata(dev));
+}
+
+static void usb_kbd_close(struct input_dev *dev)
+{
+    usb_kbd_put_io(input_get_drvdata(dev));
+}
+
+/* Take or drop the aggregate device's use of @kbd, under usb_kbd_agg->mutex */
+static void usb_kbd_aggregate_hold(struct usb_kbd *kbd, bool hold)
+{
+    int error;
+
+    if (hold == kbd->agg_io)
+        return;
+    if (!hold)
+    {
+        usb_kbd_put_io(kbd);
+        kbd->agg_io = false;
+        return;
+    }
+    error = usb_kbd_get_io(kbd);
+    if (error)
+        hid_warn(kbd->usbdev, "cannot start for the aggregate device (%d)\n", error);
+    kbd->agg_io = !error;
+}
+
+static int usb_kbd_aggregate_open(struct input_dev *dev)
+{
+    struct usb_kbd_aggregate *agg = input_get_drvdata(dev);
+    struct usb_kbd *kbd;
+
+    mutex_lock(&agg->mutex);
+    agg->opened = true;
+    list_for_each_entry(kbd, &agg->members, agg_node)
+        usb_kbd_aggregate_hold(kbd, true);
+    mutex_unlock(&agg->mutex);
+    return 0;
+}
+
+static void usb_kbd_aggregate_close(struct input_dev *dev)
+{
+    struct usb_kbd_aggregate *agg = input_get_drvdata(dev);
+    struct usb_kbd *kbd;
+
+    mutex_lock(&agg->mutex);
+    agg->opened = false;
+    list_for_each_entry(kbd, &agg->members, agg_node)
+        usb_kbd_aggregate_hold(kbd, false);
+    mutex_unlock(&agg->mutex);
+}
+
+static void usb_kbd_aggregate_join(struct usb_kbd *kbd)
+{
+    struct usb_kbd_aggregate *agg = usb_kbd_agg;
+
+    if (!agg)
+        return;
+    mutex_lock(&agg->mutex);
+    list_add_tail(&kbd->agg_node, &agg->members);
+    usb_kbd_aggregate_hold(kbd, agg->opened);
+    mutex_unlock(&agg->mutex);
+}
+
+static void usb_kbd_aggregate_leave(struct usb_kbd *kbd)
+{
+    struct usb_kbd_aggregate *agg = usb_kbd_agg;
+
+    if (!agg)
+        return;
+    mutex_lock(&agg->mutex);
+    list_del(&kbd->agg_node);
+    usb_kbd_aggregate_hold(kbd, false);
+    mutex_unlock(&agg->mutex);
+}
+
+static int usb_kbd_aggregate_init(void)
+{
+    struct usb_kbd_aggregate *agg;
+    struct input_dev *dev;
+    unsigned int i;
+    int error;
+
+    if (!aggregate)
+        return 0;
+
+    agg = kzalloc(sizeof(*agg), GFP_KERNEL);
+    dev = input_allocate_device();
+    if (!agg || !dev)
+    {
+        error = -ENOMEM;
+        goto fail;
+    }
+    spin_lock_init(&agg->lock);
+    mutex_init(&agg->mutex);
+    INIT_LIST_HEAD(&agg->members);
+
+    dev->name = "usbkbd aggregate";
+    dev->phys = "usbkbd/aggregate";
+    dev->id.bustype = BUS_VIRTUAL;
+    dev->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_REP);
+    /*
+     * Capabilities are read once by userspace, so advertise up front
+     * everything the keycode and consumer tables produce; keycodes only a
+     * runtime keymap adds stay on the members' own devices.
+     */
+    memcpy(dev->keybit, usb_kbd_keybit, sizeof(dev->keybit));
+    for (i = 0; i < usb_kbd_consumer_nusages; i++)
+        __set_bit(usb_kbd_consumer_usages[i].keycode, dev->keybit);
+    dev->open = usb_kbd_aggregate_open;
+    dev->close = usb_kbd_aggregate_close;
+    input_set_drvdata(dev, agg);
+    agg->dev = dev;
+
+    error = input_register_device(dev);
+    if (error)
+        goto fail;
+    usb_kbd_agg = agg;
+    static_branch_enable(&usb_kbd_agg_on);
+    return 0;
+
+fail:
+    input_free_device(dev);
+    kfree(agg);
+    return error;
+}
+
+static void usb_kbd_aggregate_exit(void)
+{
+    if (!usb_kbd_agg)
+        return;
+    static_branch_disable(&usb_kbd_agg_on);
+    input_unregister_device(usb_kbd_agg->dev);
+    kfree(usb_kbd_agg);
+    usb_kbd_agg = NULL;
+}
+
+/* Find the report descriptor length in the interface's HID class descriptor */
+static int usb_kbd_report_desc_len(struct usb_host_interface *interface)
+{
+    const u8 *extra = interface->extra;
+    int left = interface->extralen;
+
+    while (left >= 2 && extra[0] >= 2 && extra[0] <= left)
+    {
+        if (extra[1] == HID_DT_HID && extra[0] >= 6)
+        {
+            int i;
+
+            /* bLength, bDescriptorType, bcdHID, bCountryCode, bNumDescriptors */
+            for (i = 0; i < extra[5] && 6 + 3 * i + 3 <= extra[0]; i++)
+                if (extra[6 + 3 * i] == HID_DT_REPORT)
+                    return extra[7 + 3 * i] | (extra[8 + 3 * i] << 8);
+            return -ENODEV;
+        }
+        left -= extra[0];
+        extra += extra[0];
+    }
+    return -ENODEV;
+}
+
+/* HID SET_PROTOCOL: 0 = boot, 1 = report */
+static int usb_kbd_set_protocol(struct usb_kbd *kbd, struct usb_interface *iface, int protocol)
+{
+    int error;
+
+    error = usb_control_msg(kbd->usbdev, usb_sndctrlpipe(kbd->usbdev, 0),
+                            HID_REQ_SET_PROTOCOL, USB_TYPE_CLASS | USB_RECIP_INTERFACE,
+                            protocol, iface->cur_altsetting->desc.bInterfaceNumber,
+                            NULL, 0, USB_CTRL_SET_TIMEOUT);
+    return error < 0 ? error : 0;
+}
+
+/* Read the report descriptor of @iface into a kmalloc()ed buffer; returns its length */
+static int usb_kbd_get_report_desc(struct usb_device *dev, struct usb_interface *iface, u8 **descp)
+{
+    struct usb_host_interface *interface = iface->cur_altsetting;
+    int len = usb_kbd_report_desc_len(interface);
+    u8 *desc;
+    int error;
+
+    if (len < 0)
+        return len;
+    if (!len || len > HID_MAX_DESCRIPTOR_SIZE)
+        return -EINVAL;
+
+    desc = kmalloc(len, GFP_KERNEL);
+    if (!desc)
+        return -ENOMEM;
+
+    error = usb_control_msg(dev, usb_rcvctrlpipe(dev, 0),
+                            USB_REQ_GET_DESCRIPTOR, USB_DIR_IN | USB_RECIP_INTERFACE,
+                            HID_DT_REPORT << 8, interface->desc.bInterfaceNumber, desc, len,
+                            USB_CTRL_GET_TIMEOUT);
+    if (error != len)
+    {
+        kfree(desc);
+        return error < 0 ? error : -EPROTO;
+    }
+    *descp = desc;
+    return len;
+}
+
+/*
+ * Parse the report descriptor once and switch the device to report
+ * protocol.  On any failure the device stays on the boot protocol path.
+ */
+static int usb_kbd_setup_report_protocol(struct usb_kbd *kbd, struct usb_interface *iface,
+                                         int maxp)
+{
+    u8 *desc;
+    int len, error;
+
+    len = usb_kbd_get_report_desc(kbd->usbdev, iface, &desc);
+    if (len < 0)
+        return len;
+    error = usb_kbd_parse_report_desc(desc, len, &kbd->layout);
+    kfree(desc);
+    if (error)
+        return error;
+
+    if (kbd->layout.report_len > maxp)
+        return -EMSGSIZE;
+
+    error = usb_kbd_set_protocol(kbd, iface, 1);
+    if (error)
+        return error;
+
+    kbd->report_mode = true;
+    return 0;
+}
+
+static struct usb_driver usb_kbd_driver;
+
+/*
+ * (Re)allocate the report_queue ring with room for @payload bytes per
+ * report, keeping it if it already has.  The ring must not be running.
+ */
+static int usb_kbd_alloc_queue(struct usb_kbd *kbd, unsigned int payload)
+{
+    u32 stride = ALIGN(sizeof(struct usb_kbd_queued) + payload, 8);
+    u8 *queue;
+
+    if (kbd->queue && stride <= kbd->queue_stride)
+        return 0;
+    queue = kvmalloc_array(kbd->queue_mask + 1, stride, GFP_KERNEL);
+    if (!queue)
+        return -ENOMEM;
+    kvfree(kbd->queue);
+    kbd->queue = queue;
+    kbd->queue_stride = stride;
+    return 0;
+}
+
+/*
+ * Many keyboards put their media and power keys on a second HID
+ * interface with a consumer-page report.  Claim it, the way cdc-acm
+ * claims its data interface, so those keys come out of this input
+ * device too.  Anything unexpected just leaves the interface alone; a
+ * companion already bound to usbhid is skipped.
+ */
+static void usb_kbd_claim_consumer(struct usb_kbd *kbd)
+{
+    struct usb_host_config *config = kbd->usbdev->actconfig;
+    struct usb_endpoint_descriptor *endpoint;
+    struct usb_host_interface *interface;
+    struct usb_kbd_consumer *cc;
+    struct usb_interface *other;
+    struct urb *urb;
+    u8 *desc;
+    int i, len, error;
+
+    cc = kzalloc(sizeof(*cc), GFP_KERNEL);
+    if (!cc)
+        return;
+
+    for (i = 0; i < config->desc.bNumInterfaces; i++)
+    {
+        other = config->interface[i];
+        if (!other || other == kbd->intf || usb_interface_claimed(other))
+            continue;
+        interface = other->cur_altsetting;
+        if (interface->desc.bInterfaceClass != USB_INTERFACE_CLASS_HID ||
+            interface->desc.bInterfaceProtocol == USB_INTERFACE_PROTOCOL_KEYBOARD ||
+            usb_find_int_in_endpoint(interface, &endpoint))
+            continue;
+
+        len = usb_kbd_get_report_desc(kbd->usbdev, other, &desc);
+        if (len < 0)
+            continue;
+        error = usb_kbd_parse_consumer_desc(desc, len, &cc->layout);
+        kfree(desc);
+        if (error)
+            continue;
+
+        cc->len = usb_endpoint_maxp(endpoint);
+        cc->buf = usb_alloc_coherent(kbd->usbdev, cc->len, GFP_KERNEL, &cc->dma);
+        urb = usb_alloc_urb(0, GFP_KERNEL);
+        if (!cc->buf || !urb || (kbd->queue && usb_kbd_alloc_queue(kbd, cc->len)) ||
+            usb_driver_claim_interface(&usb_kbd_driver, other, kbd))
+        {
+            usb_free_urb(urb);
+            usb_free_coherent(kbd->usbdev, cc->len, cc->buf, cc->dma);
+            break;
+        }
+
+        usb_fill_int_urb(urb, kbd->usbdev, usb_rcvintpipe(kbd->usbdev, endpoint->bEndpointAddress),
+                         cc->buf, cc->len, usb_kbd_consumer_irq, kbd, endpoint->bInterval);
+        urb->transfer_dma = cc->dma;
+        urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+        cc->intf = other;
+        kbd->consumer = cc;
+        kbd->irq[kbd->nr_irq] = urb;
+        kbd->nr_urbs = kbd->nr_irq + 1;
+        hid_info(kbd->usbdev, "media keys on interface %d\n", interface->desc.bInterfaceNumber);
+        return;
+    }
+    kfree(cc);
+}
+
+/* Undo usb_kbd_claim_consumer(); its URB goes with the keyboard's */
+static void usb_kbd_release_consumer(struct usb_kbd *kbd)
+{
+    struct usb_kbd_consumer *cc = kbd->consumer;
+
+    if (!cc)
+        return;
+    /* Its disconnect finds no driver data and leaves the rest to us */
+    usb_set_intfdata(cc->intf, NULL);
+    usb_driver_release_interface(&usb_kbd_driver, cc->intf);
+}
+
+/* The keys the consumer interface can actually send */
+static void usb_kbd_consumer_keybits(const struct usb_kbd_consumer_layout *layout, unsigned long *keybit)
+{
+    u64 mask = 0;
+    unsigned int i;
+
+    for (i = 0; i < layout->nfields; i++)
+        mask |= layout->fields[i].mask;
+    for (i = 0; i < usb_kbd_consumer_nusages; i++)
+        if (mask & BIT_ULL(i))
+            __set_bit(usb_kbd_consumer_usages[i].keycode, keybit);
+}
+
+static void usb_kbd_free_consumer(struct usb_kbd *kbd)
+{
+    struct usb_kbd_consumer *cc = kbd->consumer;
+
+    if (!cc)
+        return;
+    usb_free_coherent(kbd->usbdev, cc->len, cc->buf, cc->dma);
+    kfree(cc);
+    kbd->consumer = NULL;
+}
+
+static int usb_kbd_probe(struct usb_interface *iface, const struct usb_device_id *id)
+{
+    const struct usb_kbd_quirks *quirks = id->driver_info ? (const void *)id->driver_info : &usb_kbd_no_quirks;
+    struct usb_device *dev = interface_to_usbdev(iface);
+    struct usb_host_interface *interface = iface->cur_altsetting;
+    struct usb_endpoint_descriptor *endpoint;
+    struct usb_kbd *kbd;
+    struct usb_kbd_keymap *keymap;
+    struct usb_kbd_led_rules *led_rules;
+    struct input_dev *input_dev;
+    unsigned char *led_buf;
+    int pipe, maxp, i;
+    int error = -ENOMEM;
+
+    if (usb_find_int_in_endpoint(interface, &endpoint))
+        return -ENODEV;
+    if (quirks != &usb_kbd_no_quirks)
+        hid_info(dev, "quirks %#x, poll %u us, LED report id %u\n", quirks->flags,
+                 quirks->poll_interval_us, quirks->led_report_id);
+    if (quirks->flags & USB_KBD_QUIRK_RESET_RESUME)
+        dev->quirks |= USB_QUIRK_RESET_RESUME;
+
+    pipe = usb_rcvintpipe(dev, endpoint->bEndpointAddress);
+    maxp = usb_maxpacket(dev, pipe);
+
+    /* Everything the completion handler reads for each report shares a cache line */
+    BUILD_BUG_ON(offsetofend(struct usb_kbd, layout) > 64);
+
+    kbd = kzalloc(sizeof(struct usb_kbd), GFP_KERNEL);
+    input_dev = input_allocate_device();
+    if (!kbd || !input_dev)
+        goto fail1;
+
+    kbd->usbdev = dev;
+    kbd->intf = iface;
+    kbd->dev = input_dev;
+    usb_kbd_core_init(&kbd->core);
+    spin_lock_init(&kbd->leds_lock);
+    spin_lock_init(&kbd->keymap_lock);
+    INIT_DELAYED_WORK(&kbd->led_work, usb_kbd_led_work);
+    INIT_DELAYED_WORK(&kbd->diag_work, usb_kbd_diag_work);
+    mutex_init(&kbd->io_mutex);
+    mutex_init(&kbd->led_rules_mutex);
+    spin_lock_init(&kbd->health_lock);
+    INIT_DELAYED_WORK(&kbd->backoff_work, usb_kbd_backoff_work);
+    INIT_WORK(&kbd->report_work, usb_kbd_report_work);
+    kbd->diag_next = jiffies;
+    /* jiffies starts near the wrap, so 0 would read as a recent submit */
+    kbd->led_last = jiffies - msecs_to_jiffies(READ_ONCE(led_interval_ms));
+    memset(kbd->debounce.window_ms, min_t(unsigned int, READ_ONCE(debounce_ms), U8_MAX), sizeof(kbd->debounce.window_ms));
+    kbd->debouncing = kbd->debounce.window_ms[0] != 0;
+
+    kbd->stats = alloc_percpu(struct usb_kbd_stats);
+    if (!kbd->stats)
+        goto fail1;
+
+    led_rules = kmalloc(sizeof(*led_rules), GFP_KERNEL);
+    if (!led_rules)
+        goto fail1;
+    usb_kbd_led_policy_default(&led_rules->policy);
+    RCU_INIT_POINTER(kbd->led_rules, led_rules);
+
+    kbd->new_len = maxp > 8 ? 8 : maxp;
+    if (report_protocol && !(quirks->flags & USB_KBD_QUIRK_BOOT_PROTOCOL))
+    {
+        error = usb_kbd_setup_report_protocol(kbd, iface, maxp);
+        if (error)
+            hid_warn(dev, "report protocol unavailable (%d), using boot protocol\n", error);
+        else
+            kbd->new_len = maxp;
+        error = -ENOMEM;
+    }
+
+    kbd->nr_irq = clamp_val(irq_urbs, 1, USB_KBD_MAX_IRQ_URBS);
+    kbd->nr_urbs = kbd->nr_irq;
+    kbd->dma_len = kbd->nr_irq * kbd->new_len + 2;
+    kbd->dma_buf = usb_alloc_coherent(dev, kbd->dma_len, GFP_KERNEL, &kbd->dma);
+    if (!kbd->dma_buf)
+        goto fail1;
+    kbd->new = kbd->dma_buf;
+    led_buf = kbd->dma_buf + kbd->nr_irq * kbd->new_len;
+    led_buf[0] = quirks->led_report_id;
+    kbd->leds = led_buf + !!quirks->led_report_id;
+
+    if (report_queue)
+    {
+        kbd->queue_mask = roundup_pow_of_two(min(report_queue, USB_KBD_MAX_QUEUE)) - 1;
+        if (usb_kbd_alloc_queue(kbd, kbd->new_len))
+            goto fail3;
+    }
+
+    for (i = 0; i < kbd->nr_irq; i++)
+    {
+        kbd->irq[i] = usb_alloc_urb(0, GFP_KERNEL);
+        if (!kbd->irq[i])
+            goto fail3;
+    }
+
+    kbd->led = usb_alloc_urb(0, GFP_KERNEL);
+    if (!kbd->led)
+        goto fail3;
+
+    keymap = kmalloc(sizeof(*keymap), GFP_KERNEL);
+    if (!keymap)
+        goto fail4;
+    usb_kbd_default_keymap(keymap);
+    RCU_INIT_POINTER(kbd->keymap, keymap);
+
+    kbd->endpoint = endpoint;
+    kbd->desc_interval = endpoint->bInterval;
+    i = READ_ONCE(poll_interval_us) ?: quirks->poll_interval_us;
+    if (i)
+    {
+        error = usb_kbd_encode_interval(dev, i);
+        if (error >= 0)
+            error = usb_kbd_set_interval(kbd, error);
+        if (error)
+            hid_warn(dev, "cannot poll every %d us at %s speed (%d), using %u us\n", i,
+                     usb_speed_string(dev->speed), error,
+                     usb_kbd_interval_us(dev, endpoint->bInterval));
+        error = -ENOMEM;
+    }
+
+    for (i = 0; i < kbd->nr_irq; i++)
+    {
+        usb_fill_int_urb(kbd->irq[i], dev, pipe,
+                         kbd->new + i * kbd->new_len, kbd->new_len,
+                         usb_kbd_irq_handler(kbd), kbd, endpoint->bInterval);
+        kbd->irq[i]->transfer_dma = kbd->dma + i * kbd->new_len;
+        kbd->irq[i]->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+    }
+
+    kbd->cr.bRequestType = USB_TYPE_CLASS | USB_RECIP_INTERFACE;
+    kbd->cr.bRequest = HID_REQ_SET_REPORT;
+    kbd->cr.wValue = cpu_to_le16(HID_OUTPUT_REPORT << 8 | quirks->led_report_id);
+    kbd->cr.wIndex = cpu_to_le16(interface->desc.bInterfaceNumber);
+    kbd->cr.wLength = cpu_to_le16(kbd->leds + 1 - led_buf);
+
+    usb_fill_control_urb(kbd->led, dev, usb_sndctrlpipe(dev, 0),
+                         (void *)&kbd->cr, led_buf, kbd->leds + 1 - led_buf,
+                         usb_kbd_led, kbd);
+    kbd->led->transfer_dma = kbd->dma + (led_buf - kbd->dma_buf);
+    kbd->led->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+    usb_make_path(dev, kbd->phys, sizeof(kbd->phys));
+    strlcat(kbd->phys, "/input0", sizeof(kbd->phys));
+
+    input_dev->name = "USB HIDBP Keyboard";
+    input_dev->phys = kbd->phys;
+    usb_to_input_id(dev, &input_dev->id);
+    input_dev->dev.parent = &iface->dev;
+
+    input_set_drvdata(input_dev, kbd);
+
+    input_dev->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_LED) | BIT_MASK(EV_REP);
+    input_dev->ledbit[0] = BIT_MASK(LED_NUML) | BIT_MASK(LED_CAPSL) | BIT_MASK(LED_SCROLLL) |
+                           BIT_MASK(LED_COMPOSE) | BIT_MASK(LED_KANA);
+    /* Every key the translation table produces, prebuilt at compile time */
+    BUILD_BUG_ON(sizeof(usb_kbd_keybit) != sizeof(input_dev->keybit));
+    memcpy(input_dev->keybit, keymap->keybit, sizeof(input_dev->keybit));
+
+    usb_kbd_claim_consumer(kbd);
+    if (kbd->consumer)
+        usb_kbd_consumer_keybits(&kbd->consumer->layout, input_dev->keybit);
+
+    input_dev->open = usb_kbd_open;
+    input_dev->close = usb_kbd_close;
+    input_dev->event = usb_kbd_event;
+    input_dev->getkeycode = usb_kbd_getkeycode;
+    input_dev->setkeycode = usb_kbd_setkeycode;
+
+    error = input_register_device(kbd->dev);
+    if (error)
+        goto fail5;
+
+    usb_set_intfdata(iface, kbd);
+    device_set_wakeup_enable(&dev->dev, 1);
+    /* usbcore leaves it off until userspace writes power/control */
+    if (READ_ONCE(autosuspend))
+        usb_enable_autosuspend(dev);
+
+    kbd->debugfs = debugfs_create_dir(dev_name(&iface->dev), usb_kbd_debugfs_root);
+    debugfs_create_file("latency", 0444, kbd->debugfs, kbd, &usb_kbd_latency_fops);
+    debugfs_create_file("counters", 0444, kbd->debugfs, kbd, &usb_kbd_counters_fops);
+    debugfs_create_file_unsafe("capture", 0600, kbd->debugfs, kbd, &usb_kbd_capture_fops);
+    debugfs_create_file("rate", 0444, kbd->debugfs, kbd, &usb_kbd_rate_fops);
+
+    usb_kbd_aggregate_join(kbd);
+    return 0;
+
+fail5:
+    usb_kbd_release_consumer(kbd);
+    endpoint->bInterval = kbd->desc_interval;
+    kfree(keymap);
+fail4:
+    usb_free_urb(kbd->led);
+fail3:
+    usb_kbd_free_irq_urbs(kbd);
+    usb_kbd_free_consumer(kbd);
+    kvfree(kbd->queue);
+    usb_free_coherent(dev, kbd->dma_len, kbd->dma_buf, kbd->dma);
+fail1:
+    if (kbd)
+    {
+        kfree(rcu_access_pointer(kbd->led_rules));
+        free_percpu(kbd->stats);
+    }
+    input_free_device(input_dev);
+    kfree(kbd);
+    return error;
+}
+
+/* Unbinding either the keyboard or its consumer interface tears down both */
+static void usb_kbd_disconnect(struct usb_interface *intf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(intf);
+
+    usb_set_intfdata(intf, NULL);
+    if (!kbd)
+        return;
+
+    usb_set_intfdata(kbd->intf, NULL);
+    if (intf != kbd->intf)
+        usb_driver_release_interface(&usb_kbd_driver, kbd->intf);
+    else
+        usb_kbd_release_consumer(kbd);
+
+    usb_kbd_aggregate_leave(kbd);
+    debugfs_remove_recursive(kbd->debugfs);
+    /* Closes the device, so no new reports or LED events after this */
+    input_unregister_device(kbd->dev);
+    cancel_delayed_work_sync(&kbd->backoff_work);
+    usb_kbd_kill_irq_urbs(kbd);
+    usb_poison_urb(kbd->led);
+    cancel_delayed_work_sync(&kbd->led_work);
+    cancel_delayed_work_sync(&kbd->diag_work);
+    usb_kbd_free_irq_urbs(kbd);
+    usb_kbd_free_consumer(kbd);
+    usb_free_urb(kbd->led);
+    /* Whoever binds next starts from the device's own interval */
+    kbd->endpoint->bInterval = kbd->desc_interval;
+    kvfree(kbd->queue);
+    usb_free_coherent(kbd->usbdev, kbd->dma_len, kbd->dma_buf, kbd->dma);
+    kfree(rcu_access_pointer(kbd->keymap));
+    kfree(rcu_access_pointer(kbd->led_rules));
+    free_percpu(kbd->stats);
+    /* Pages still mapped by a reader are only released on munmap */
+    vfree(kbd->capture);
+    kfree(kbd);
+}
+
+/*
+ * The PM and reset callbacks act on the keyboard interface only, which
+ * stops and restarts the consumer interface's URB along with its own.
+ */
+static struct usb_kbd *usb_kbd_pm_data(struct usb_interface *intf)
+{
+    struct usb_kbd *kbd = usb_get_intfdata(intf);
+
+    return kbd && kbd->intf == intf ? kbd : NULL;
+}
+
+/*
+ * Device reset, queued by the error path or requested by anyone else.
+ * The ring is stopped for the duration; io_mutex is held from pre_reset
+ * to post_reset so open/close wait for the reset to finish.
+ */
+static int usb_kbd_pre_reset(struct usb_interface *intf)
+{
+    struct usb_kbd *kbd = usb_kbd_pm_data(intf);
+
+    if (!kbd)
+        return 0;
+
+    mutex_lock(&kbd->io_mutex);
+    usb_kbd_stop_io(kbd);
+    usb_kill_urb(kbd->led);
+    cancel_delayed_work_sync(&kbd->led_work);
+    return 0;
+}
+
+/* The device was reset and is back in boot protocol */
+static void usb_kbd_restore_protocol(struct usb_kbd *kbd)
+{
+    if (kbd->report_mode && usb_kbd_set_protocol(kbd, kbd->intf, 1))
+    {
+        hid_warn(kbd->usbdev, "report protocol lost after reset, using boot protocol\n");
+        kbd->report_mode = false;
+    }
+}
+
+static int usb_kbd_post_reset(struct usb_interface *intf)
+{
+    struct usb_kbd *kbd = usb_kbd_pm_data(intf);
+    unsigned long flags;
+    int error = 0;
+
+    if (!kbd)
+        return 0;
+
+    usb_kbd_restore_protocol(kbd);
+
+    spin_lock_irqsave(&kbd->health_lock, flags);
+    kbd->error_streak = 0;
+    kbd->resetting = false;
+    spin_unlock_irqrestore(&kbd->health_lock, flags);
+
+    if (kbd->opened)
+        error = usb_kbd_start_io(kbd);
+    mutex_unlock(&kbd->io_mutex);
+
+    /* The device forgot its LED state as well */
+    spin_lock_irqsave(&kbd->leds_lock, flags);
+    kbd->led_resend = true;
+    usb_kbd_led_kick(kbd);
+    spin_unlock_irqrestore(&kbd->leds_lock, flags);
+
+    return error;
+}
+
+/*
+ * Runtime and system suspend.  While the keyboard is idle the ring is
+ * stopped and the device autosuspends with remote wakeup armed; a key
+ * press wakes it and its report is read once resume resubmits the ring.
+ */
+static int usb_kbd_suspend(struct usb_interface *intf, pm_message_t message)
+{
+    struct usb_kbd *kbd = usb_kbd_pm_data(intf);
+    unsigned long flags;
+
+    if (!kbd)
+        return 0;
+
+    spin_lock_irqsave(&kbd->leds_lock, flags);
+    if (PMSG_IS_AUTO(message) &&
+        (kbd->led_urb_submitted || kbd->newleds != *kbd->leds || kbd->led_resend))
+    {
+        /* An LED update is on its way; let it finish first */
+        spin_unlock_irqrestore(&kbd->leds_lock, flags);
+        return -EBUSY;
+    }
+    kbd->suspended = true;
+    spin_unlock_irqrestore(&kbd->leds_lock, flags);
+
+    mutex_lock(&kbd->io_mutex);
+    usb_kbd_stop_io(kbd);
+    mutex_unlock(&kbd->io_mutex);
+    usb_kill_urb(kbd->led);
+    cancel_delayed_work_sync(&kbd->led_work);
+
+    kbd->suspends++;
+    kbd->suspend_ns = ktime_get_ns();
+    return 0;
+}
+
+static int usb_kbd_resume(struct usb_interface *intf)
+{
+    struct usb_kbd *kbd = usb_kbd_pm_data(intf);
+    unsigned long flags;
+    int error = 0;
+
+    if (!kbd)
+        return 0;
+
+    kbd->resumes++;
+    kbd->resume_ns = ktime_get_ns();
+    usb_kbd_hist_add(&kbd->suspended_for, kbd->resume_ns - kbd->suspend_ns);
+
+    /* Ring first, so the report of the key that woke us is picked up early */
+    mutex_lock(&kbd->io_mutex);
+    if (kbd->opened)
+        error = usb_kbd_start_io(kbd);
+    mutex_unlock(&kbd->io_mutex);
+
+    /* Power may have been cut during system sleep, resend the LED state regardless */
+    spin_lock_irqsave(&kbd->leds_lock, flags);
+    kbd->suspended = false;
+    kbd->led_resend = true;
+    usb_kbd_led_kick(kbd);
+    if (kbd->led_wakeup)
+    {
+        kbd->led_wakeup = false;
+        usb_autopm_put_interface_async(kbd->intf);
+    }
+    spin_unlock_irqrestore(&kbd->leds_lock, flags);
+
+    return error;
+}
+
+static int usb_kbd_reset_resume(struct usb_interface *intf)
+{
+    struct usb_kbd *kbd = usb_kbd_pm_data(intf);
+
+    if (!kbd)
+        return 0;
+
+    usb_kbd_restore_protocol(kbd);
+    return usb_kbd_resume(intf);
+}
+
+static const struct usb_device_id usb_kbd_id_table[] = {
+    {USB_DEVICE_AND_INTERFACE_INFO(USB_VENDOR_ID, USB_PRODUCT_ID, USB_INTERFACE_CLASS_HID,
+                                   USB_INTERFACE_SUBCLASS_BOOT, USB_INTERFACE_PROTOCOL_KEYBOARD),
+     .driver_info = (kernel_ulong_t)&usb_kbd_quirks_0c45_760a},
+    {USB_INTERFACE_INFO(USB_INTERFACE_CLASS_HID, USB_INTERFACE_SUBCLASS_BOOT, USB_INTERFACE_PROTOCOL_KEYBOARD)},
+    {}};
+
+MODULE_DEVICE_TABLE(usb, usb_kbd_id_table);
+
+static struct usb_driver usb_kbd_driver = {
+    .name = "usbkbd",
+    .probe = usb_kbd_probe,
+    .disconnect = usb_kbd_disconnect,
+    .suspend = usb_kbd_suspend,
+    .resume = usb_kbd_resume,
+    .reset_resume = usb_kbd_reset_resume,
+    .pre_reset = usb_kbd_pre_reset,
+    .post_reset = usb_kbd_post_reset,
+    .supports_autosuspend = 1,
+    .id_table = usb_kbd_id_table,
+    .dev_groups = usb_kbd_groups,
+};
+
+static int __init usb_kbd_init(void)
+{
+    int error;
+
+    usb_kbd_wq = alloc_workqueue("usbkbd", WQ_HIGHPRI, 0);
+    if (!usb_kbd_wq)
+        return -ENOMEM;
+
+    error = usb_kbd_hotkey_init();
+    if (error)
+        goto fail_hotkey;
+
+    error = usb_kbd_aggregate_init();
+    if (error)
+        goto fail_aggregate;
+
+    usb_kbd_debugfs_root = debugfs_create_dir("usbkbd", NULL);
+    error = usb_register(&usb_kbd_driver);
+    if (error)
+        goto fail_register;
+    return 0;
+
+fail_register:
+    debugfs_remove_recursive(usb_kbd_debugfs_root);
+    usb_kbd_aggregate_exit();
+fail_aggregate:
+    usb_kbd_hotkey_exit();
+fail_hotkey:
+    destroy_workqueue(usb_kbd_wq);
+    return error;
+}
+
+static void __exit usb_kbd_exit(void)
+{
+    usb_deregister(&usb_kbd_driver);
+    debugfs_remove_recursive(usb_kbd_debugfs_root);
+    usb_kbd_aggregate_exit();
+    usb_kbd_hotkey_exit();
+    destroy_workqueue(usb_kbd_wq);
+}
+
+module_init(usb_kbd_init);
+module_exit(usb_kbd_exit);
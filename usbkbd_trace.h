@@ -0,0 +1,95 @@
+/* Tracepoints along the URB -> input and LED paths of the usbkbd driver */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM usbkbd
+
+#if !defined(_USBKBD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _USBKBD_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/usb.h>
+
+DECLARE_EVENT_CLASS(usbkbd_urb,
+    TP_PROTO(struct usb_device *udev, int status, unsigned int len),
+    TP_ARGS(udev, status, len),
+    TP_STRUCT__entry(
+        __field(u16, bus)
+        __field(u16, devnum)
+        __field(int, status)
+        __field(unsigned int, len)
+    ),
+    TP_fast_assign(
+        __entry->bus = udev->bus->busnum;
+        __entry->devnum = udev->devnum;
+        __entry->status = status;
+        __entry->len = len;
+    ),
+    TP_printk("%u-%u status=%d len=%u",
+              __entry->bus, __entry->devnum, __entry->status, __entry->len)
+);
+
+/* Interrupt URB completion, before any decoding */
+DEFINE_EVENT(usbkbd_urb, usbkbd_urb_complete,
+    TP_PROTO(struct usb_device *udev, int status, unsigned int len),
+    TP_ARGS(udev, status, len)
+);
+
+/* LED control URB completion */
+DEFINE_EVENT(usbkbd_urb, usbkbd_led_complete,
+    TP_PROTO(struct usb_device *udev, int status, unsigned int len),
+    TP_ARGS(udev, status, len)
+);
+
+DECLARE_EVENT_CLASS(usbkbd_report,
+    TP_PROTO(struct usb_device *udev, unsigned int events, u64 ns),
+    TP_ARGS(udev, events, ns),
+    TP_STRUCT__entry(
+        __field(u16, bus)
+        __field(u16, devnum)
+        __field(unsigned int, events)
+        __field(u64, ns)
+    ),
+    TP_fast_assign(
+        __entry->bus = udev->bus->busnum;
+        __entry->devnum = udev->devnum;
+        __entry->events = events;
+        __entry->ns = ns;
+    ),
+    TP_printk("%u-%u events=%u since_complete=%lluns",
+              __entry->bus, __entry->devnum, __entry->events, __entry->ns)
+);
+
+/* Report diffed into key events */
+DEFINE_EVENT(usbkbd_report, usbkbd_decoded,
+    TP_PROTO(struct usb_device *udev, unsigned int events, u64 ns),
+    TP_ARGS(udev, events, ns)
+);
+
+/* input_sync() done, events are visible to evdev */
+DEFINE_EVENT(usbkbd_report, usbkbd_input_sync,
+    TP_PROTO(struct usb_device *udev, unsigned int events, u64 ns),
+    TP_ARGS(udev, events, ns)
+);
+
+TRACE_EVENT(usbkbd_led_submit,
+    TP_PROTO(struct usb_device *udev, u8 leds),
+    TP_ARGS(udev, leds),
+    TP_STRUCT__entry(
+        __field(u16, bus)
+        __field(u16, devnum)
+        __field(u8, leds)
+    ),
+    TP_fast_assign(
+        __entry->bus = udev->bus->busnum;
+        __entry->devnum = udev->devnum;
+        __entry->leds = leds;
+    ),
+    TP_printk("%u-%u leds=%#04x", __entry->bus, __entry->devnum, __entry->leds)
+);
+
+#endif /* _USBKBD_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE usbkbd_trace
+#include <trace/define_trace.h>